@@ -0,0 +1,144 @@
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import time
+
+BASE_PATH = os.path.dirname(os.path.abspath(__file__))
+ROOT_PATH = os.path.dirname(BASE_PATH)
+WORKLOADS_PATH = BASE_PATH + "/workloads/"
+DATA_PATH = BASE_PATH + "/data/"
+BASELINE_PATH = BASE_PATH + "/baseline.json"
+RESULTS_PATH = BASE_PATH + "/results.json"
+INTERPRETER_PATH = ROOT_PATH + "/build/sb"
+# Changes within this fraction of the baseline are reported as noise
+THRESHOLD = 0.05
+
+
+def generate_data():
+    """Write the input file used by readfile_parse.sb and stream_parse.sb if it is missing."""
+    path = DATA_PATH + "records.txt"
+    if os.path.exists(path):
+        return
+    os.makedirs(DATA_PATH, exist_ok=True)
+    with open(path, "w") as f:
+        for i in range(20000):
+            f.write(f"{i},item-{i % 97},{i * 7 % 1000}.{i % 100},region-{i % 13}\n")
+
+
+def read_peak_rss(pid):
+    """Read the high water mark of a running process in KB."""
+    try:
+        with open(f"/proc/{pid}/status", "r") as f:
+            for line in f:
+                if line.startswith("VmHWM:"):
+                    return int(line.split()[1])
+    except (OSError, ValueError):
+        pass
+    return 0
+
+
+def run_once(cmd):
+    """Run the interpreter once returning wall time and peak RSS in KB.
+    The high water mark is polled from /proc while the process runs,
+    rusage is not used as a forked child inherits Python's own peak."""
+    start = time.perf_counter()
+    proc = subprocess.Popen(cmd, cwd=ROOT_PATH, stdout=subprocess.DEVNULL)
+    peak = 0
+    while proc.poll() is None:
+        peak = max(peak, read_peak_rss(proc.pid))
+        time.sleep(0.001)
+    wall = time.perf_counter() - start
+    if proc.returncode != 0:
+        raise RuntimeError(f"{' '.join(cmd)} exited with status {proc.returncode}")
+    return wall, peak
+
+
+def count_instructions(cmd):
+    """Count user space instructions retired with perf, None when
+    perf is missing or the counter is not available."""
+    perf = shutil.which("perf")
+    if perf is None:
+        return None
+    result = subprocess.run([perf, "stat", "-x", ",", "-e", "instructions:u"] + cmd,
+                            cwd=ROOT_PATH, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE)
+    for line in result.stderr.decode("utf-8").splitlines():
+        fields = line.split(",")
+        if len(fields) > 2 and fields[2].startswith("instructions") and fields[0].isdigit():
+            return int(fields[0])
+    return None
+
+
+def run_workload(file, runs, extra_args):
+    cmd = [INTERPRETER_PATH, WORKLOADS_PATH + file] + extra_args
+    walls = []
+    rss = []
+    for _ in range(runs):
+        wall, peak = run_once(cmd)
+        walls.append(wall)
+        rss.append(peak)
+    return {
+        "wall_median_s": round(statistics.median(walls), 4),
+        "wall_min_s": round(min(walls), 4),
+        "peak_rss_kb": max(rss),
+        "instructions": count_instructions(cmd),
+        "runs": runs,
+    }
+
+
+def compare(name, result, baseline):
+    """Describe the change in median wall time against the baseline."""
+    if name not in baseline:
+        return "new"
+    before = baseline[name]["wall_median_s"]
+    after = result["wall_median_s"]
+    if before == 0:
+        return "n/a"
+    change = (after - before) / before
+    if abs(change) < THRESHOLD:
+        return f"{change:+.1%} (noise)"
+    return f"{change:+.1%} ({'slower' if change > 0 else 'faster'})"
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the Small Basic benchmark suite")
+    parser.add_argument("--runs", type=int, default=5, help="runs per workload")
+    parser.add_argument("--filter", default="", help="only run workloads containing this text")
+    parser.add_argument("--save-baseline", action="store_true", help="store the results as the new baseline")
+    parser.add_argument("args", nargs="*", help="extra interpreter flags, for example --tree")
+    options = parser.parse_args()
+
+    generate_data()
+    baseline = {}
+    if os.path.exists(BASELINE_PATH):
+        with open(BASELINE_PATH, "r") as f:
+            stored = json.load(f)
+        if stored["args"] != options.args:
+            print(f"Note: baseline was recorded with flags {stored['args']}")
+        baseline = stored["workloads"]
+
+    results = {}
+    print(f"{'workload':<20} {'median s':>10} {'min s':>10} {'rss KB':>10} {'instructions':>14}  vs baseline")
+    for file in sorted(os.listdir(WORKLOADS_PATH)):
+        if not file.endswith(".sb") or options.filter not in file:
+            continue
+        name = file[:-3]
+        result = run_workload(file, options.runs, options.args)
+        results[name] = result
+        instructions = result["instructions"] if result["instructions"] is not None else "-"
+        print(f"{name:<20} {result['wall_median_s']:>10.4f} {result['wall_min_s']:>10.4f} "
+              f"{result['peak_rss_kb']:>10} {instructions:>14}  {compare(name, result, baseline)}")
+
+    report = {"args": options.args, "workloads": results}
+    with open(RESULTS_PATH, "w") as f:
+        json.dump(report, f, indent=2)
+    if options.save_baseline:
+        with open(BASELINE_PATH, "w") as f:
+            json.dump(report, f, indent=2)
+        print(f"Saved baseline to {BASELINE_PATH}")
+
+
+if __name__ == "__main__":
+    main()
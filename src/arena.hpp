@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+
+/// Bump allocator handing out memory from large blocks. Nothing
+/// is freed individually, release() drops every block at once.
+/// Objects with destructors register a cleanup to run first.
+class Arena {
+public:
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    Arena() {
+        this->next = NULL;
+        this->end = NULL;
+    }
+
+    ~Arena() {
+        release();
+    }
+
+    void *allocate(size_t size) {
+        const size_t align = alignof(std::max_align_t);
+        size = (size + align - 1) & ~(align - 1);
+        if (next == NULL || (size_t)(end - next) < size) {
+            size_t blockSize = size > BLOCK_SIZE ? size : BLOCK_SIZE;
+            char *block = (char *)malloc(blockSize);
+            blocks.push_back(block);
+            next = block;
+            end = block + blockSize;
+        }
+        void *result = next;
+        next += size;
+        return result;
+    }
+
+    /// Run cleanup(object) when the arena is released,
+    /// cleanups run in reverse order of registration.
+    void addCleanup(void (*cleanup)(void*), void *object) {
+        cleanups.push_back({cleanup, object});
+    }
+
+    void release() {
+        for (size_t i = cleanups.size(); i > 0; i--) {
+            cleanups[i - 1].cleanup(cleanups[i - 1].object);
+        }
+        cleanups.clear();
+        for (size_t i = 0; i < blocks.size(); i++) {
+            free(blocks[i]);
+        }
+        blocks.clear();
+        next = NULL;
+        end = NULL;
+    }
+
+private:
+    struct Cleanup {
+        void (*cleanup)(void*);
+        void *object;
+    };
+
+    std::vector<char*> blocks;
+    std::vector<Cleanup> cleanups;
+    char *next;
+    char *end;
+};
+
+/// Standard allocator drawing from an arena, deallocate is a
+/// no-op as the memory goes back with the arena.
+template <typename T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+
+    Arena *arena;
+
+    ArenaAllocator(Arena *arena) {
+        this->arena = arena;
+    }
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &other) {
+        this->arena = other.arena;
+    }
+
+    T *allocate(size_t n) {
+        return (T *)arena->allocate(n * sizeof(T));
+    }
+
+    void deallocate(T *, size_t) {}
+
+    template <typename U>
+    bool operator==(const ArenaAllocator<U> &other) const {
+        return arena == other.arena;
+    }
+
+    template <typename U>
+    bool operator!=(const ArenaAllocator<U> &other) const {
+        return arena != other.arena;
+    }
+};
@@ -1,43 +1,72 @@
+#pragma once
+
 #include <cstring>
 #include <cstdlib>
+#include "value.hpp"
+
+/// Characters of the string literal the lexer is reading, kept
+/// by each parse so separate parses may run at once.
+class LiteralBuffer {
+public:
+    LiteralBuffer() {
+        this->str = NULL;
+        this->strLength = 0;
+        this->strCapacity = 0;
+    }
+
+    ~LiteralBuffer() {
+        free(str);
+    }
+
+    /// Clear the current string being built to a
+    /// blank string.
+    void clear() {
+        reserve(0);
+        strLength = 0;
+        str[0] = '\0';
+    }
+
+    /// Add a character to the string buffer
+    /// handles string resizing.
+    void append(char c) {
+        reserve(1);
+        str[strLength++] = c;
+        str[strLength] = '\0';
+    }
+
+    /// Append a series of characters to the
+    /// string buffer, handles string resizing.
+    void append(const char *str2, size_t length) {
+        reserve(length);
+        memcpy(str + strLength, str2, length);
+        strLength += length;
+        str[strLength] = '\0';
+    }
+
+    /// Return the interned copy of the current buffer, the only
+    /// copy made of a literal. The buffer itself is reused for the
+    /// next literal.
+    const char *intern() {
+        return ::intern(str, strLength)->chars();
+    }
+
+private:
+    char *str;          // The string currently being built
+    size_t strLength;   // Characters in use, excluding the terminator
+    size_t strCapacity;
 
-static char *str; // The string currntly being built
-
-/// Clear the current string being built to a
-/// blank string.
-void clearBuffer() {
-    str = "";
-}
-
-/// Add a character to the string buffer
-/// handles string resizing.
-void appendBuffer(char c) {
-    int currentLen = strlen(str);
-    int lenWithNullTerminator = currentLen + 1;
-    int newLen = lenWithNullTerminator + 1;
-
-    char *newStr = (char *)malloc(sizeof(char) * newLen);
-    strcpy(newStr, str);
-    newStr[newLen - 1] = '\0';
-    newStr[newLen - 2] = c;
-    str = newStr;
-}
-
-/// Append a series of characters to the
-/// string buffer, handles string resizing.
-void appendBufferStr(char *str2) {
-    int currentLen = strlen(str);
-    int lenWithNullTerminator = currentLen + 1;
-    int newLen = lenWithNullTerminator + strlen(str2);
-    char *result = (char *)malloc(sizeof(char) * newLen);
-    strcpy(result, str);
-    strcat(result, str2);
-    str = result;
-}
-
-/// Return a deep copy of the current buffer.
-char *copyBuffer() {
-    char *copy = (char *)malloc(sizeof(char) * (strlen(str) + 1));
-    strcpy(copy, str);
-    return copy;
-}
\ No newline at end of file
+    /// Grow the buffer so it can hold extra more characters
+    /// plus the terminator, doubling to keep appends cheap.
+    void reserve(size_t extra) {
+        size_t needed = strLength + extra + 1;
+        if (needed <= strCapacity) {
+            return;
+        }
+        size_t capacity = strCapacity == 0 ? 64 : strCapacity;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        str = (char *)realloc(str, capacity);
+        strCapacity = capacity;
+    }
+};
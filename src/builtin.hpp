@@ -1,34 +1,66 @@
 #pragma once
 #include "value.hpp"
+#include "output.hpp"
+#include "kernels.hpp"
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <string>
 #include <random>
 #include <fstream>
+#include <cmath>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/// Arguments to a builtin call. A view of values on the tree
+/// walker's argument stack or of VM registers, never copied.
+class ArgList {
+public:
+    ArgList(Value *values, size_t count) {
+        this->values = values;
+        this->count = count;
+    }
+
+    size_t size() const { return count; }
+    const Value &operator[](size_t i) const { return values[i]; }
+
+private:
+    Value *values;
+    size_t count;
+};
 
 /// Abstract builtin class for an inbuilt
 /// Small Basic function. Can take arguments.
+/// The number of arguments is checked by the resolver before
+/// the program runs, so execute can rely on it.
 class Builtin {
 public:
-    Builtin() {}
-    virtual Value *execute(int lineNum, std::vector<Value*> *args) { return NULL; };
+    const char *name;
+    size_t arity;
+
+    Builtin(const char *name, size_t arity) {
+        this->name = name;
+        this->arity = arity;
+    }
+    virtual ~Builtin() {}
+    virtual Value execute(int lineNum, ArgList args) { return Value::null(); };
+    /// Pure builtins always give the same result for the same
+    /// arguments, so calls on constants can be folded.
+    virtual bool isPure() { return false; }
 };
 
 /// Read a line from stdin and return it as
 /// a Small Basic StringValue.
 class ReadLine : public Builtin {
 public:
-    ReadLine() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 0) {
-            return new ErrorValue(lineNum, "Expected 0 arguments when calling input!");
-        }
+    ReadLine() : Builtin("input", 0) {}
+    Value execute(int lineNum, ArgList args) {
+        // Show any prompt printed before waiting for the line
+        flushOutput();
         std::string line;
         std::getline(std::cin, line);
-        char *tmp = (char *)malloc(line.size() + 1);
-        strcpy(tmp, line.c_str());
-        return new StringValue(tmp);
+        return Value::string(line.c_str(), line.size());
     }
 };
 
@@ -36,195 +68,523 @@ public:
 /// Small BAsic NumberValue.
 class Random : public Builtin {
 public:
-    Random() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 2) {
-            return new ErrorValue(lineNum, "Expected 2 arguments when calling random!");
+    Random() : Builtin("random", 2) {}
+    Value execute(int lineNum, ArgList args) {
+        Value min = args[0];
+        Value max = args[1];
+        if (!min.isNumber() || !max.isNumber()) {
+            return makeError(lineNum, "Expected 2 number values for min and max!");
         }
-        Value *mi = (*args)[0];
-        Value *ma = (*args)[1];
-        if (mi->type != VAL_NUMBER || ma->type != VAL_NUMBER) {
-            return new ErrorValue(lineNum, "Expected 2 number values for min and max!");
-        }
-        NumberValue *min = dynamic_cast<NumberValue*>(mi);
-        NumberValue *max = dynamic_cast<NumberValue*>(ma);
         double f = sqrt((double)rand() / RAND_MAX);
-        return new NumberValue(min->number + f * (max->number - min->number));
+        return Value::number(min.asNumber() + f * (max.asNumber() - min.asNumber()));
     }
 };
 
 /// Floor a given number.
 class Floor : public Builtin {
 public:
-    Floor() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 arguments when calling floor!");
-        }
-        Value *num = (*args)[0];
-        if (num->type != VAL_NUMBER) {
-            return new ErrorValue(lineNum, "Expected 1 number value!");
+    Floor() : Builtin("floor", 1) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        Value num = args[0];
+        if (!num.isNumber()) {
+            return makeError(lineNum, "Expected 1 number value!");
         }
-        NumberValue *number = dynamic_cast<NumberValue*>(num);
-        double floored = std::floor(number->number);
-        return new NumberValue(floored);
+        double floored = std::floor(num.asNumber());
+        return Value::number(floored);
     }
 };
 
 /// Ceil a given number.
 class Ceil : public Builtin {
 public:
-    Ceil() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 arguments when calling ceil!");
+    Ceil() : Builtin("ceil", 1) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        Value num = args[0];
+        if (!num.isNumber()) {
+            return makeError(lineNum, "Expected 1 number value!");
         }
-        Value *num = (*args)[0];
-        if (num->type != VAL_NUMBER) {
-            return new ErrorValue(lineNum, "Expected 1 number value!");
-        }
-        NumberValue *number = dynamic_cast<NumberValue*>(num);
-        double ceiled = std::ceil(number->number);
-        return new NumberValue(ceiled);
+        double ceiled = std::ceil(num.asNumber());
+        return Value::number(ceiled);
     }
 };
 
 /// Return the value for pi
 class Pi : public Builtin {
 public:
-    Pi() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 0) {
-            return new ErrorValue(lineNum, "Expected 0 arguments when calling pi!");
-        }
-        return new NumberValue(3.14159);
+    Pi() : Builtin("pi", 0) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        return Value::number(3.14159);
     }
 };
 
 /// Sqrt a given number
 class Sqrt : public Builtin {
 public:
-    Sqrt() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 arguments when calling sqrt!");
+    Sqrt() : Builtin("sqrt", 1) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        Value num = args[0];
+        if (!num.isNumber()) {
+            return makeError(lineNum, "Expected 1 number value!");
         }
-        Value *num = (*args)[0];
-        if (num->type != VAL_NUMBER) {
-            return new ErrorValue(lineNum, "Expected 1 number value!");
-        }
-        NumberValue *number = dynamic_cast<NumberValue*>(num);
-        double rooted = std::sqrt(number->number);
-        return new NumberValue(rooted);
+        double rooted = std::sqrt(num.asNumber());
+        return Value::number(rooted);
     }
 };
 
 /// Calculate the cos for a given value
 class Cos : public Builtin {
 public:
-    Cos() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 arguments when calling cos!");
-        }
-        Value *num = (*args)[0];
-        if (num->type != VAL_NUMBER) {
-            return new ErrorValue(lineNum, "Expected 1 number value!");
+    Cos() : Builtin("cos", 1) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        Value num = args[0];
+        if (!num.isNumber()) {
+            return makeError(lineNum, "Expected 1 number value!");
         }
-        NumberValue *number = dynamic_cast<NumberValue*>(num);
-        double cossed = std::cos(number->number);
-        return new NumberValue(cossed);
+        double cossed = std::cos(num.asNumber());
+        return Value::number(cossed);
     }
 };
 
 /// Calculate the sin for a given value
 class Sin : public Builtin {
 public:
-    Sin() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 arguments when calling sin!");
+    Sin() : Builtin("sin", 1) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        Value num = args[0];
+        if (!num.isNumber()) {
+            return makeError(lineNum, "Expected 1 number value!");
         }
-        Value *num = (*args)[0];
-        if (num->type != VAL_NUMBER) {
-            return new ErrorValue(lineNum, "Expected 1 number value!");
-        }
-        NumberValue *number = dynamic_cast<NumberValue*>(num);
-        double sinned = std::sin(number->number);
-        return new NumberValue(sinned);
+        double sinned = std::sin(num.asNumber());
+        return Value::number(sinned);
     }
 };
 
 /// Calculate the tan for a given value
 class Tan : public Builtin {
 public:
-    Tan() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 arguments when calling tan!");
-        }
-        Value *num = (*args)[0];
-        if (num->type != VAL_NUMBER) {
-            return new ErrorValue(lineNum, "Expected 1 number value!");
+    Tan() : Builtin("tan", 1) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        Value num = args[0];
+        if (!num.isNumber()) {
+            return makeError(lineNum, "Expected 1 number value!");
         }
-        NumberValue *number = dynamic_cast<NumberValue*>(num);
-        double tanned = std::tan(number->number);
-        return new NumberValue(tanned);
+        double tanned = std::tan(num.asNumber());
+        return Value::number(tanned);
     }
 };
 
 /// Read a specified file into a Small Basic
-/// ListValue of StringValues
+/// ListValue of StringValues. Regular files are mapped and
+/// each line longer than a small string is a view into the
+/// mapping, so no characters are copied. The mapping lives
+/// until the last line referencing it is freed.
 class ReadFile : public Builtin {
 public:
-    ReadFile() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 argument when calling read file!");
+    ReadFile() : Builtin("readfile", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        Value path = args[0];
+        if (!path.isString()) {
+            return makeError(lineNum, "Expect file path to be a string!");
         }
-        Value *path = (*args)[0];
-        if (path->type != VAL_STRING) {
-            return new ErrorValue(lineNum, "Expect file path to be a string!");
+        StringRef filePath(path);
+        std::string pathString(filePath.data(), filePath.size());
+
+        int fd = open(pathString.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return makeError(lineNum, "Could not find file with specified path!");
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+            // Pipes and devices cannot be mapped, nor can empty files
+            close(fd);
+            return readStream(lineNum, pathString);
         }
-        StringValue *filePath = dynamic_cast<StringValue*>(path);
+        size_t size = info.st_size;
+        void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            return readStream(lineNum, pathString);
+        }
+        madvise(data, size, MADV_SEQUENTIAL);
+
+        StringBuffer *buffer = new StringBuffer();
+        buffer->data = (char *)data;
+        buffer->used = size;
+        buffer->capacity = size;
+        buffer->refCount = 1;
+        buffer->mapped = true;
 
-        std::ifstream file(filePath->string);
         ListValue *lines = new ListValue();
-        if (file.is_open()) {
-            std::string line;
-                while (std::getline(file, line)) {
-                    // Read each line into a string value and add to list
-                    lines->addValue(new StringValue(line.c_str()));
-                }
-            file.close();
-        } else {
-            return new ErrorValue(lineNum, "Could not find file with specified path!");
+        Value result = Value::object(lines);
+        const char *chars = buffer->data;
+        size_t start = 0;
+        while (start < size) {
+            const char *newline = (const char *)memchr(chars + start, '\n', size - start);
+            size_t end = newline != NULL ? newline - chars : size;
+            size_t length = end - start;
+            if (length <= Value::SMALL_STRING_MAX) {
+                lines->addValue(Value::string(chars + start, length));
+            } else {
+                lines->addValue(Value::object(new StringValue(buffer, start, length)));
+            }
+            start = end + 1;
+        }
+        releaseBuffer(buffer);
+
+        return result;
+    }
+
+private:
+    /// Read a file that cannot be mapped a line at a time.
+    Value readStream(int lineNum, const std::string &path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            return makeError(lineNum, "Could not find file with specified path!");
+        }
+
+        ListValue *lines = new ListValue();
+        Value result = Value::object(lines);
+        std::string line;
+        while (std::getline(file, line)) {
+            // Read each line into a string value and add to list
+            lines->addValue(Value::string(line.c_str(), line.size()));
+        }
+        file.close();
+
+        return result;
+    }
+};
+
+/// Open a file to be read a line at a time with nextline
+/// and currentline, without loading all of it.
+class OpenFile : public Builtin {
+public:
+    OpenFile() : Builtin("openfile", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        Value path = args[0];
+        if (!path.isString()) {
+            return makeError(lineNum, "Expect file path to be a string!");
         }
+        StringRef filePath(path);
+        FILE *file = fopen(std::string(filePath.data(), filePath.size()).c_str(), "r");
+        if (file == NULL) {
+            return makeError(lineNum, "Could not find file with specified path!");
+        }
+        return Value::object(new FileValue(file));
+    }
+};
 
-        return lines;
+/// Advance an open file to its next line, returns False
+/// once every line has been read.
+class NextLine : public Builtin {
+public:
+    NextLine() : Builtin("nextline", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        Value file = args[0];
+        if (file.type() != VAL_FILE) {
+            return makeError(lineNum, "Expected a file opened with openfile!");
+        }
+        if (file.as<FileValue>()->shared) {
+            return makeError(lineNum, "Parallel For iterations cannot read a shared file!");
+        }
+        return Value::boolean(file.as<FileValue>()->next());
+    }
+};
+
+/// Return the line an open file was last advanced to.
+class CurrentLine : public Builtin {
+public:
+    CurrentLine() : Builtin("currentline", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        Value file = args[0];
+        if (file.type() != VAL_FILE) {
+            return makeError(lineNum, "Expected a file opened with openfile!");
+        }
+        const Value &line = file.as<FileValue>()->line;
+        if (line.isNull()) {
+            return makeError(lineNum, "File has no current line, nextline has not read one!");
+        }
+        StringValue *s = line.as<StringValue>();
+        if (s->length <= Value::SMALL_STRING_MAX) {
+            // Short lines are packed inline so the buffer stays reusable
+            return Value::string(s->chars(), s->length);
+        }
+        return line;
     }
 };
 
 /// Returns the length of a Small Basic value
 class Len : public Builtin {
 public:
-    Len() {}
-    Value *execute(int lineNum, std::vector<Value*> *args) {
-        if (args->size() != 1) {
-            return new ErrorValue(lineNum, "Expected 1 argument when calling read file!");
-        }
-        Value *structure = (*args)[0];
-        if (structure->type == VAL_LIST) {
-            ListValue *list = dynamic_cast<ListValue*>(structure);
-            return new NumberValue(list->values.size());
-        } else if (structure->type == VAL_MAP) {
-            MapValue *map = dynamic_cast<MapValue*>(structure);
-            return new NumberValue(map->map.size());
-        } else if (structure->type == VAL_STRING) {
-            StringValue *string = dynamic_cast<StringValue*>(structure);
-            return new NumberValue(strlen(string->string));
+    Len() : Builtin("len", 1) {}
+    bool isPure() { return true; }
+    Value execute(int lineNum, ArgList args) {
+        Value structure = args[0];
+        if (structure.type() == VAL_LIST) {
+            ListValue *list = structure.as<ListValue>();
+            return Value::number(list->size());
+        } else if (structure.type() == VAL_MAP) {
+            MapValue *map = structure.as<MapValue>();
+            return Value::number(map->size());
+        } else if (structure.type() == VAL_STRING) {
+            return Value::number(StringRef(structure).size());
         } else {
-            return new ErrorValue(lineNum, "Cannot compute len of given type!");
+            return makeError(lineNum, "Cannot compute len of given type!");
         }
     }
 };
+
+/// Add a value to the end of a list.
+class Append : public Builtin {
+public:
+    Append() : Builtin("append", 2) {}
+    Value execute(int lineNum, ArgList args) {
+        if (args[0].type() != VAL_LIST) {
+            return makeError(lineNum, "Expected a list to append to!");
+        }
+        ListValue *list = args[0].as<ListValue>();
+        if (list->shared) {
+            return makeError(lineNum, "Parallel For iterations cannot change the length of a shared list!");
+        }
+        list->addValue(args[1]);
+        return Value::null();
+    }
+};
+
+/// Remove and return the last value of a list.
+class Pop : public Builtin {
+public:
+    Pop() : Builtin("pop", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        if (args[0].type() != VAL_LIST) {
+            return makeError(lineNum, "Expected a list to pop from!");
+        }
+        ListValue *list = args[0].as<ListValue>();
+        if (list->shared) {
+            return makeError(lineNum, "Parallel For iterations cannot change the length of a shared list!");
+        }
+        if (list->size() == 0) {
+            return makeError(lineNum, "Cannot pop from an empty list!");
+        }
+        return list->removeValue(list->size() - 1);
+    }
+};
+
+/// Insert a value before an index of a list, an index
+/// equal to the length appends.
+class Insert : public Builtin {
+public:
+    Insert() : Builtin("insert", 3) {}
+    Value execute(int lineNum, ArgList args) {
+        if (args[0].type() != VAL_LIST || !args[1].isNumber()) {
+            return makeError(lineNum, "Expected a list and a number index!");
+        }
+        ListValue *list = args[0].as<ListValue>();
+        if (list->shared) {
+            return makeError(lineNum, "Parallel For iterations cannot change the length of a shared list!");
+        }
+        double index = args[1].asNumber();
+        if (!(index >= 0 && index <= list->size())) {
+            return makeError(lineNum, "Cannot insert outside bounds of list!");
+        }
+        list->insertValue((size_t)index, args[2]);
+        return Value::null();
+    }
+};
+
+/// Remove and return the value at an index of a list.
+class Remove : public Builtin {
+public:
+    Remove() : Builtin("remove", 2) {}
+    Value execute(int lineNum, ArgList args) {
+        if (args[0].type() != VAL_LIST || !args[1].isNumber()) {
+            return makeError(lineNum, "Expected a list and a number index!");
+        }
+        ListValue *list = args[0].as<ListValue>();
+        if (list->shared) {
+            return makeError(lineNum, "Parallel For iterations cannot change the length of a shared list!");
+        }
+        if (!list->inBounds(args[1].asNumber())) {
+            return makeError(lineNum, "Cannot index outside bounds of list!");
+        }
+        return list->removeValue((size_t)args[1].asNumber());
+    }
+};
+
+/// The values of a list from a start index up to but not
+/// including an end index. The slice shares the list's
+/// values until one of them is changed.
+class Slice : public Builtin {
+public:
+    Slice() : Builtin("slice", 3) {}
+    Value execute(int lineNum, ArgList args) {
+        if (args[0].type() != VAL_LIST || !args[1].isNumber() || !args[2].isNumber()) {
+            return makeError(lineNum, "Expected a list and 2 number indexes!");
+        }
+        ListValue *list = args[0].as<ListValue>();
+        if (list->shared) {
+            return makeError(lineNum, "Parallel For iterations cannot slice a shared list!");
+        }
+        double start = args[1].asNumber();
+        double end = args[2].asNumber();
+        if (!(start >= 0 && start <= end && end <= list->size())) {
+            return makeError(lineNum, "Cannot slice outside bounds of list!");
+        }
+        size_t first = start;
+        return Value::object(new ListValue(list, first, (size_t)end - first));
+    }
+};
+
+/// Join two lists into a new list.
+class Concat : public Builtin {
+public:
+    Concat() : Builtin("concat", 2) {}
+    Value execute(int lineNum, ArgList args) {
+        if (args[0].type() != VAL_LIST || args[1].type() != VAL_LIST) {
+            return makeError(lineNum, "Expected 2 lists!");
+        }
+        ListValue *left = args[0].as<ListValue>();
+        ListValue *right = args[1].as<ListValue>();
+        ListValue *joined = new ListValue();
+        Value result = Value::object(joined);
+        joined->reserve(left->size() + right->size());
+        for (size_t i = 0; i < left->size(); i++) {
+            joined->addValue((*left)[i]);
+        }
+        for (size_t i = 0; i < right->size(); i++) {
+            joined->addValue((*right)[i]);
+        }
+        return result;
+    }
+};
+
+/// Helper for the bulk list builtins, the list of numbers held
+/// by a value or NULL when it is not one.
+inline ListValue *numberList(const Value &v) {
+    if (v.type() != VAL_LIST || !v.as<ListValue>()->isNumeric()) {
+        return NULL;
+    }
+    return v.as<ListValue>();
+}
+
+/// Add up a list of numbers.
+class Sum : public Builtin {
+public:
+    Sum() : Builtin("sum", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        ListValue *list = numberList(args[0]);
+        if (list == NULL) {
+            return makeError(lineNum, "Expected a list of numbers!");
+        }
+        return Value::number(sumNumbers(list->numbers(), list->size()));
+    }
+};
+
+/// Average a non empty list of numbers.
+class Mean : public Builtin {
+public:
+    Mean() : Builtin("mean", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        ListValue *list = numberList(args[0]);
+        if (list == NULL || list->size() == 0) {
+            return makeError(lineNum, "Expected a non empty list of numbers!");
+        }
+        size_t count = list->size();
+        return Value::number(sumNumbers(list->numbers(), count) / count);
+    }
+};
+
+/// Smallest number in a non empty list.
+class Min : public Builtin {
+public:
+    Min() : Builtin("min", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        ListValue *list = numberList(args[0]);
+        if (list == NULL || list->size() == 0) {
+            return makeError(lineNum, "Expected a non empty list of numbers!");
+        }
+        return Value::number(minNumbers(list->numbers(), list->size()));
+    }
+};
+
+/// Largest number in a non empty list.
+class Max : public Builtin {
+public:
+    Max() : Builtin("max", 1) {}
+    Value execute(int lineNum, ArgList args) {
+        ListValue *list = numberList(args[0]);
+        if (list == NULL || list->size() == 0) {
+            return makeError(lineNum, "Expected a non empty list of numbers!");
+        }
+        return Value::number(maxNumbers(list->numbers(), list->size()));
+    }
+};
+
+/// Dot product of two lists of numbers of the same length.
+class Dot : public Builtin {
+public:
+    Dot() : Builtin("dot", 2) {}
+    Value execute(int lineNum, ArgList args) {
+        ListValue *left = numberList(args[0]);
+        ListValue *right = numberList(args[1]);
+        if (left == NULL || right == NULL) {
+            return makeError(lineNum, "Expected 2 lists of numbers!");
+        }
+        if (left->size() != right->size()) {
+            return makeError(lineNum, "Expected lists of the same length!");
+        }
+        return Value::number(dotNumbers(left->numbers(), right->numbers(), left->size()));
+    }
+};
+
+/// Multiply every number in a list by a factor, giving a new list.
+class Scale : public Builtin {
+public:
+    Scale() : Builtin("scale", 2) {}
+    Value execute(int lineNum, ArgList args) {
+        ListValue *list = numberList(args[0]);
+        if (list == NULL || !args[1].isNumber()) {
+            return makeError(lineNum, "Expected a list of numbers and a number!");
+        }
+        size_t count = list->size();
+        ListValue *scaled = new ListValue();
+        Value result = Value::object(scaled);
+        scaleNumbers(list->numbers(), args[1].asNumber(), scaled->appendNumbers(count), count);
+        return result;
+    }
+};
+
+/// Add or multiply two lists of numbers element by element,
+/// giving a new list.
+class Elementwise : public Builtin {
+public:
+    Elementwise(const char *name, void (*kernel)(const double*, const double*, double*, size_t))
+        : Builtin(name, 2) {
+        this->kernel = kernel;
+    }
+    Value execute(int lineNum, ArgList args) {
+        ListValue *left = numberList(args[0]);
+        ListValue *right = numberList(args[1]);
+        if (left == NULL || right == NULL) {
+            return makeError(lineNum, "Expected 2 lists of numbers!");
+        }
+        if (left->size() != right->size()) {
+            return makeError(lineNum, "Expected lists of the same length!");
+        }
+        size_t count = left->size();
+        ListValue *combined = new ListValue();
+        Value result = Value::object(combined);
+        kernel(left->numbers(), right->numbers(), combined->appendNumbers(count), count);
+        return result;
+    }
+
+private:
+    void (*kernel)(const double*, const double*, double*, size_t);
+};
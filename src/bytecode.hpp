@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "value.hpp"
+
+class Builtin;
+
+/// Enum containing every instruction understood by the VM.
+/// R[x] is register x of the current frame, K[x] is constant x
+/// of the current chunk and G[x] is global slot x. A Sub's
+/// parameters and locals are the first registers of its frame.
+enum OpCode : uint8_t {
+    OP_LOADK,     // R[A] = K[C]
+    OP_MOVE,      // R[A] = R[B]
+    OP_GETGLOBAL, // R[A] = G[C]
+    OP_SETGLOBAL, // G[C] = R[A]
+    OP_ADD,       // R[A] = R[B] + R[C]
+    OP_SUB,       // R[A] = R[B] - R[C]
+    OP_MUL,       // R[A] = R[B] * R[C]
+    OP_DIV,       // R[A] = R[B] / R[C]
+    OP_LT,        // R[A] = R[B] < R[C]
+    OP_GT,        // R[A] = R[B] > R[C]
+    OP_LE,        // R[A] = R[B] <= R[C]
+    OP_GE,        // R[A] = R[B] >= R[C]
+    OP_EQ,        // R[A] = R[B] == R[C]
+    OP_AND,       // R[A] = R[B] And R[C]
+    OP_OR,        // R[A] = R[B] Or R[C]
+    OP_NEG,       // R[A] = -R[B]
+    OP_JMP,       // pc = C
+    OP_JMPIFNOT,  // if not R[A] then pc = C
+    OP_PRINT,     // Print(R[A])
+    OP_NEWLIST,   // R[A] = []
+    OP_LISTPUSH,  // append R[B] to the list in R[A]
+    OP_NEWMAP,    // R[A] = {}
+    OP_INDEX,     // R[A] = R[B][R[C]]
+    OP_SETINDEX,  // R[A][R[B]] = R[C]
+    OP_BUILTIN,   // R[A] = builtins[C](R[A] .. R[A + B - 1])
+    OP_CALL,      // call the Sub in chunk C, its frame starts at R[A] holding B arguments
+    OP_TAILCALL,  // move the B arguments from R[A] to R[0] and run chunk C in the current frame
+    OP_GETLOCAL,  // R[A] = R[B], erroring when the local R[B] is unassigned
+    OP_FORINIT,   // check R[A] is a number, G[B] = R[A]
+    OP_FORINITLOCAL, // check R[A] is a number, R[B] = R[A]
+    OP_FORPREP,   // check R[A + 1] and R[A + 2], R[A + 3] = 0, if the loop is done then pc = C
+    OP_FORLOOP,   // R[A + 3] += 1, G[B] = R[A] + R[A + 3] * R[A + 2], if the loop continues then pc = C
+    OP_FORLOOPLOCAL, // R[A + 3] += 1, R[B] = R[A] + R[A + 3] * R[A + 2], if the loop continues then pc = C
+    OP_PARFOR,    // run Parallel For loops[C] from R[A] to R[A + 1] stepping by R[A + 2]
+    OP_DEBUG,     // debugger hook after the statement on line C
+    OP_LINE,      // profiler hook, the statement on line C is starting
+    OP_RETURN     // return from the current chunk, handing back R[A] when B is set
+};
+
+/// A single fixed width VM instruction.
+struct Instruction {
+    OpCode op;
+    uint8_t a;
+    uint16_t b;
+    uint32_t c;
+};
+
+/// A compiled body of code, either the top level program
+/// or a single Sub.
+struct Chunk {
+    std::string name;
+    std::vector<Instruction> code;
+    std::vector<int> lines;         // Source line of each instruction
+    std::vector<Value> constants;
+    int numRegisters = 0;
+};
+
+/// A Parallel For. Its body is a chunk run once per iteration
+/// with the counter and then each sum as arguments.
+struct ParallelLoop {
+    uint32_t chunk;
+    std::vector<uint32_t> sums; // Global slots the sums are added to
+};
+
+/// A whole compiled program. Chunk 0 is the top level
+/// and the rest are Subs referenced by OP_CALL.
+struct Bytecode {
+    std::vector<Chunk*> chunks;
+    std::vector<Builtin*> builtins; // Builtins called by OP_BUILTIN
+    std::vector<ParallelLoop> loops; // Parallel Fors run by OP_PARFOR
+
+    ~Bytecode() {
+        for (size_t i = 0; i < chunks.size(); i++) {
+            delete chunks[i];
+        }
+    }
+};
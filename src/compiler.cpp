@@ -0,0 +1,452 @@
+#include "compiler.hpp"
+#include "evaluator.hpp"
+
+#include <unordered_map>
+
+#define MAX_REGISTERS 256
+
+/// Walks the AST once and emits bytecode for the VM.
+/// Registers are handed out stack style, an expression is
+/// always compiled into a target register and any temporaries
+/// it needs sit above it.
+class Compiler {
+public:
+    Compiler(Bytecode *out, bool debugHooks, bool profileHooks) {
+        this->out = out;
+        this->debugHooks = debugHooks;
+        this->profileHooks = profileHooks;
+        this->chunk = NULL;
+        this->freeReg = 0;
+    }
+
+    Value compileProgram(ProgramNode *prog) {
+        Chunk *main = new Chunk();
+        main->name = "main";
+        out->chunks.push_back(main);
+        chunk = main;
+        compileStmts(prog->getStmts());
+        emit(OP_RETURN, 0, 0, 0, prog->lineNum);
+        return error;
+    }
+
+private:
+    Bytecode *out;
+    bool debugHooks;
+    bool profileHooks;
+    Chunk *chunk;
+    int freeReg;
+    Value error;
+    std::unordered_map<Builtin*, uint32_t> builtinIndex;
+    std::unordered_map<SubNode*, uint32_t> subIndex;
+
+    size_t emit(OpCode op, int a, int b, uint32_t c, int lineNum) {
+        Instruction ins;
+        ins.op = op;
+        ins.a = (uint8_t)a;
+        ins.b = (uint16_t)b;
+        ins.c = c;
+        chunk->code.push_back(ins);
+        chunk->lines.push_back(lineNum);
+        return chunk->code.size() - 1;
+    }
+
+    /// Point the jump at index at the next instruction to be emitted.
+    void patchJump(size_t index) {
+        chunk->code[index].c = chunk->code.size();
+    }
+
+    uint32_t addConstant(Value v) {
+        chunk->constants.push_back(v);
+        return chunk->constants.size() - 1;
+    }
+
+    uint32_t addBuiltin(Builtin *builtin) {
+        auto it = builtinIndex.find(builtin);
+        if (it != builtinIndex.end()) {
+            return it->second;
+        }
+        out->builtins.push_back(builtin);
+        uint32_t index = out->builtins.size() - 1;
+        builtinIndex[builtin] = index;
+        return index;
+    }
+
+    /// Index of the chunk a Sub compiles into, the chunk is created
+    /// on first use so calls may be compiled before the Sub.
+    uint32_t chunkOf(SubNode *sub) {
+        auto it = subIndex.find(sub);
+        if (it != subIndex.end()) {
+            return it->second;
+        }
+        Chunk *subChunk = new Chunk();
+        subChunk->name = dynamic_cast<IdentifierNode*>(sub->ident)->ident;
+        out->chunks.push_back(subChunk);
+        uint32_t index = out->chunks.size() - 1;
+        subIndex[sub] = index;
+        return index;
+    }
+
+    /// Load a variable into register target.
+    void loadVar(Node *ident, int target) {
+        IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(ident);
+        if (identNode->local) {
+            emit(OP_GETLOCAL, target, identNode->slot, 0, ident->lineNum);
+        } else {
+            emit(OP_GETGLOBAL, target, 0, identNode->slot, ident->lineNum);
+        }
+    }
+
+    /// Store register r into a variable.
+    void storeVar(Node *ident, int r) {
+        IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(ident);
+        if (identNode->local) {
+            emit(OP_MOVE, identNode->slot, r, 0, ident->lineNum);
+        } else {
+            emit(OP_SETGLOBAL, r, 0, identNode->slot, ident->lineNum);
+        }
+    }
+
+    /// Global slot of a resolved variable.
+    uint32_t slotOf(Node *ident) {
+        return dynamic_cast<IdentifierNode*>(ident)->slot;
+    }
+
+    int allocReg(Node *node, int count = 1) {
+        int reg = freeReg;
+        freeReg += count;
+        if (freeReg > MAX_REGISTERS) {
+            if (error.isNull()) {
+                error = makeError(node->lineNum, "Expression too complex to compile!");
+            }
+            freeReg = reg;
+            return 0;
+        }
+        if (freeReg > chunk->numRegisters) {
+            chunk->numRegisters = freeReg;
+        }
+        return reg;
+    }
+
+    void freeRegs(int reg) {
+        freeReg = reg;
+    }
+
+    void compileStmts(NodeList *stmts) {
+        for (size_t i = 0; i < stmts->size(); i++) {
+            Node *stmt = (*stmts)[i];
+            if (profileHooks) {
+                emit(OP_LINE, 0, 0, stmt->lineNum, stmt->lineNum);
+            }
+            compileStmt(stmt);
+            if (debugHooks) {
+                emit(OP_DEBUG, 0, 0, stmt->lineNum, stmt->lineNum);
+            }
+        }
+    }
+
+    void compileStmt(Node *node) {
+        int base = freeReg;
+        switch (node->type) {
+            case NODE_PRINT: {
+                PrintNode *print = dynamic_cast<PrintNode*>(node);
+                int r = allocReg(node);
+                compileExpr(print->exp, r);
+                emit(OP_PRINT, r, 0, 0, node->lineNum);
+                break;
+            }
+            case NODE_VAR_ASSIGN: {
+                VarAssignNode *assign = dynamic_cast<VarAssignNode*>(node);
+                int r = allocReg(node);
+                compileExpr(assign->value, r);
+                storeVar(assign->ident, r);
+                break;
+            }
+            case NODE_VAR_DECL: {
+                VarDeclNode *decl = dynamic_cast<VarDeclNode*>(node);
+                int r = allocReg(node);
+                compileExpr(decl->value, r);
+                storeVar(decl->ident, r);
+                break;
+            }
+            case NODE_RETURN: {
+                ReturnNode *ret = dynamic_cast<ReturnNode*>(node);
+                if (ret->value == NULL) {
+                    emit(OP_RETURN, 0, 0, 0, node->lineNum);
+                    break;
+                }
+                if (ret->value->type == NODE_CALL && dynamic_cast<CallNode*>(ret->value)->sub != NULL) {
+                    // Returning a Sub call reuses this frame for the callee
+                    CallNode *call = dynamic_cast<CallNode*>(ret->value);
+                    ExprListNode *args = dynamic_cast<ExprListNode*>(call->args);
+                    int argc = args->exprs.size();
+                    int r = allocReg(node, argc > 0 ? argc : 1);
+                    for (int i = 0; i < argc; i++) {
+                        compileExpr(args->exprs[i], r + i);
+                    }
+                    emit(OP_TAILCALL, r, argc, chunkOf(call->sub), node->lineNum);
+                    break;
+                }
+                int r = allocReg(node);
+                compileExpr(ret->value, r);
+                emit(OP_RETURN, r, 1, 0, node->lineNum);
+                break;
+            }
+            case NODE_INDEX_ASSIGN: {
+                IndexAssignNode *idx = dynamic_cast<IndexAssignNode*>(node);
+                int r = allocReg(node, 3);
+                loadVar(idx->ident, r);
+                compileExpr(idx->index, r + 1);
+                compileExpr(idx->value, r + 2);
+                emit(OP_SETINDEX, r, r + 1, r + 2, node->lineNum);
+                break;
+            }
+            case NODE_IF: {
+                IfNode *ifNode = dynamic_cast<IfNode*>(node);
+                int r = allocReg(node);
+                compileExpr(ifNode->expr, r);
+                size_t toElse = emit(OP_JMPIFNOT, r, 0, 0, node->lineNum);
+                freeRegs(base);
+                compileStmt(ifNode->thenBranch);
+                if (ifNode->elseBranch != NULL) {
+                    size_t toEnd = emit(OP_JMP, 0, 0, 0, node->lineNum);
+                    patchJump(toElse);
+                    compileStmt(ifNode->elseBranch);
+                    patchJump(toEnd);
+                } else {
+                    patchJump(toElse);
+                }
+                break;
+            }
+            case NODE_WHILE: {
+                WhileNode *whileNode = dynamic_cast<WhileNode*>(node);
+                uint32_t top = chunk->code.size();
+                int r = allocReg(node);
+                compileExpr(whileNode->expr, r);
+                size_t toExit = emit(OP_JMPIFNOT, r, 0, 0, node->lineNum);
+                freeRegs(base);
+                compileStmt(whileNode->block);
+                if (profileHooks) {
+                    emit(OP_LINE, 0, 0, node->lineNum, node->lineNum);
+                }
+                emit(OP_JMP, 0, 0, top, node->lineNum);
+                patchJump(toExit);
+                break;
+            }
+            case NODE_FOR: {
+                ForNode *forNode = dynamic_cast<ForNode*>(node);
+                if (forNode->parallel) {
+                    compileParallelFor(forNode);
+                    break;
+                }
+                uint32_t slot = slotOf(forNode->ident);
+                bool local = dynamic_cast<IdentifierNode*>(forNode->ident)->local;
+                if (slot > UINT16_MAX && error.isNull()) {
+                    error = makeError(node->lineNum, "Too many variables to compile!");
+                }
+                // Start, bound, step and the number of the iteration
+                int r = allocReg(node, 4);
+                compileExpr(forNode->value, r);
+                emit(local ? OP_FORINITLOCAL : OP_FORINIT, r, slot, 0, node->lineNum);
+                compileExpr(forNode->max, r + 1);
+                if (forNode->step != NULL) {
+                    compileExpr(forNode->step, r + 2);
+                } else {
+                    emit(OP_LOADK, r + 2, 0, addConstant(Value::number(1)), node->lineNum);
+                }
+                size_t toExit = emit(OP_FORPREP, r, slot, 0, node->lineNum);
+                uint32_t body = chunk->code.size();
+                compileStmt(forNode->block);
+                if (profileHooks) {
+                    emit(OP_LINE, 0, 0, node->lineNum, node->lineNum);
+                }
+                emit(local ? OP_FORLOOPLOCAL : OP_FORLOOP, r, slot, body, node->lineNum);
+                patchJump(toExit);
+                break;
+            }
+            case NODE_BLOCK: {
+                BlockNode *block = dynamic_cast<BlockNode*>(node);
+                compileStmts(block->getStmts());
+                break;
+            }
+            case NODE_SUB: {
+                // Parameters and Var locals are the first registers
+                // of the Sub's frame, temporaries sit above them
+                SubNode *sub = dynamic_cast<SubNode*>(node);
+                Chunk *outer = chunk;
+                int outerFree = freeReg;
+                if (sub->numLocals > MAX_REGISTERS && error.isNull()) {
+                    error = makeError(node->lineNum, "Too many variables to compile!");
+                }
+                chunk = out->chunks[chunkOf(sub)];
+                chunk->numRegisters = sub->numLocals;
+                freeReg = sub->numLocals;
+                compileStmt(sub->block);
+                emit(OP_RETURN, 0, 0, 0, node->lineNum);
+                chunk = outer;
+                freeReg = outerFree;
+                break;
+            }
+            case NODE_EXPR: {
+                ExprNode *e = dynamic_cast<ExprNode*>(node);
+                if (e->expr != NULL) {
+                    int r = allocReg(node);
+                    compileExpr(e->expr, r);
+                }
+                break;
+            }
+            default: {
+                int r = allocReg(node);
+                compileExpr(node, r);
+                break;
+            }
+        }
+        freeRegs(base);
+    }
+
+    /// Compile a Parallel For into its bounds and an OP_PARFOR.
+    /// The body compiles into a chunk of its own like a Sub.
+    void compileParallelFor(ForNode *forNode) {
+        int r = allocReg(forNode, 3);
+        compileExpr(forNode->value, r);
+        compileExpr(forNode->max, r + 1);
+        if (forNode->step != NULL) {
+            compileExpr(forNode->step, r + 2);
+        } else {
+            emit(OP_LOADK, r + 2, 0, addConstant(Value::number(1)), forNode->lineNum);
+        }
+        compileStmt(forNode->body);
+        ParallelLoop loop;
+        loop.chunk = chunkOf(forNode->body);
+        loop.sums = parallelSums(forNode);
+        out->loops.push_back(loop);
+        emit(OP_PARFOR, r, 0, out->loops.size() - 1, forNode->lineNum);
+    }
+
+    /// Compile an expression leaving its value in register target.
+    void compileExpr(Node *node, int target) {
+        int base = freeReg;
+        switch (node->type) {
+            case NODE_NUMBER:
+                emit(OP_LOADK, target, 0, addConstant(dynamic_cast<NumberNode*>(node)->value), node->lineNum);
+                break;
+            case NODE_BOOLEAN:
+                emit(OP_LOADK, target, 0, addConstant(dynamic_cast<BooleanNode*>(node)->value), node->lineNum);
+                break;
+            case NODE_STRING:
+                emit(OP_LOADK, target, 0, addConstant(dynamic_cast<StringNode*>(node)->value), node->lineNum);
+                break;
+            case NODE_IDENTIFIER:
+                loadVar(node, target);
+                break;
+            case NODE_BINARY_OP: {
+                // Long generated chains nest down the left operand, so
+                // the chain is compiled with a loop applying each
+                // operator in turn to target
+                std::vector<BinaryOpNode*> chain;
+                Node *left = node;
+                while (left->type == NODE_BINARY_OP) {
+                    chain.push_back(dynamic_cast<BinaryOpNode*>(left));
+                    left = chain.back()->left;
+                }
+                compileExpr(left, target);
+                int r = allocReg(node);
+                for (size_t i = chain.size(); i-- > 0;) {
+                    compileExpr(chain[i]->right, r);
+                    emit(binaryOpCode(chain[i]->op), target, target, r, chain[i]->lineNum);
+                }
+                break;
+            }
+            case NODE_UNARY_OP: {
+                UnaryOpNode *unaryOp = dynamic_cast<UnaryOpNode*>(node);
+                compileExpr(unaryOp->right, target);
+                emit(OP_NEG, target, target, unaryOp->op, node->lineNum);
+                break;
+            }
+            case NODE_EXPR_LIST: {
+                ExprListNode *list = dynamic_cast<ExprListNode*>(node);
+                emit(OP_NEWLIST, target, 0, list->exprs.size(), node->lineNum);
+                int r = allocReg(node);
+                for (size_t i = 0; i < list->exprs.size(); i++) {
+                    compileExpr(list->exprs[i], r);
+                    emit(OP_LISTPUSH, target, r, 0, node->lineNum);
+                }
+                break;
+            }
+            case NODE_MAP: {
+                MapNode *map = dynamic_cast<MapNode*>(node);
+                emit(OP_NEWMAP, target, 0, 0, node->lineNum);
+                int r = allocReg(node, 2);
+                for (auto it = map->exprs.begin(); it != map->exprs.end(); it++) {
+                    compileExpr(it->first, r);
+                    compileExpr(it->second, r + 1);
+                    emit(OP_SETINDEX, target, r, r + 1, node->lineNum);
+                }
+                break;
+            }
+            case NODE_INDEX: {
+                IndexNode *idx = dynamic_cast<IndexNode*>(node);
+                loadVar(idx->ident, target);
+                int r = allocReg(node);
+                compileExpr(idx->index, r);
+                emit(OP_INDEX, target, target, r, node->lineNum);
+                break;
+            }
+            case NODE_CALL: {
+                // The arguments go in consecutive registers, a Sub's
+                // frame starts at the first so they become its locals.
+                // When target is the top register they start there, so
+                // the result needs no move and no stale copy is left.
+                CallNode *call = dynamic_cast<CallNode*>(node);
+                ExprListNode *args = dynamic_cast<ExprListNode*>(call->args);
+                int argc = args->exprs.size();
+                int r = target;
+                if (target != freeReg - 1) {
+                    r = allocReg(node, argc > 0 ? argc : 1);
+                } else if (argc > 1) {
+                    allocReg(node, argc - 1);
+                }
+                for (int i = 0; i < argc; i++) {
+                    compileExpr(args->exprs[i], r + i);
+                }
+                if (call->sub != NULL) {
+                    emit(OP_CALL, r, argc, chunkOf(call->sub), node->lineNum);
+                } else {
+                    emit(OP_BUILTIN, r, argc, addBuiltin(call->builtin), node->lineNum);
+                }
+                if (r != target) {
+                    emit(OP_MOVE, target, r, 0, node->lineNum);
+                }
+                break;
+            }
+            default:
+                if (error.isNull()) {
+                    error = makeError(node->lineNum, "Unrecognised node type!");
+                }
+                break;
+        }
+        freeRegs(base);
+    }
+
+    static OpCode binaryOpCode(char op) {
+        switch (op) {
+            case '+': return OP_ADD;
+            case '-': return OP_SUB;
+            case '*': return OP_MUL;
+            case '/': return OP_DIV;
+            case '<': return OP_LT;
+            case '>': return OP_GT;
+            case 'L': return OP_LE;
+            case 'G': return OP_GE;
+            case 'E': return OP_EQ;
+            case 'A': return OP_AND;
+            default: return OP_OR;
+        }
+    }
+};
+
+/// Compile a parsed program into bytecode. Returns an
+/// ErrorValue if the program could not be compiled.
+Value compile(ProgramNode *prog, Bytecode *out, bool debugHooks, bool profileHooks) {
+    Compiler compiler(out, debugHooks, profileHooks);
+    return compiler.compileProgram(prog);
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "node.hpp"
+#include "value.hpp"
+#include "bytecode.hpp"
+
+Value compile(ProgramNode *prog, Bytecode *out, bool debugHooks, bool profileHooks);
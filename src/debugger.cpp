@@ -0,0 +1,110 @@
+#include "debugger.hpp"
+#include "evaluator.hpp"
+#include "interpreter.hpp"
+
+#include <iostream>
+
+Debugger::Debugger(Interpreter *interp) {
+    this->interp = interp;
+    this->hooks = false;
+    this->stepMode = STEP_RUN;
+    this->callDepth = 0;
+    this->stepDepth = 0;
+}
+
+/// Add a breakpoint, it only pauses when condition is truthy
+/// if one is given.
+void Debugger::addBreakpoint(int lineNum, Node *condition) {
+    if (lineNum >= (int)breakpointLines.size()) {
+        breakpointLines.resize(lineNum + 1, false);
+    }
+    breakpointLines[lineNum] = true;
+    if (condition != NULL) {
+        conditions[lineNum] = condition;
+    }
+    hooks = true;
+}
+
+/// Switch the hooks on, --debug pauses after the first statement.
+void Debugger::start(bool stepFromStart) {
+    if (stepFromStart) {
+        stepMode = STEP_INTO;
+        hooks = true;
+    }
+}
+
+bool Debugger::conditionMet(int lineNum) {
+    auto it = conditions.find(lineNum);
+    if (it == conditions.end()) {
+        return true;
+    }
+    Value v = interp->ev(it->second);
+    if (isError(v)) {
+        std::cout << "Breakpoint condition failed, " << v.stringify() << std::endl;
+        return true;
+    }
+    return isTruthy(v);
+}
+
+/// Print a single variable by name.
+void Debugger::printVariable(const std::string &name) {
+    for (size_t i = 0; i < interp->globalNames.size(); i++) {
+        if (interp->globalNames[i] == name && !interp->globals[i].isNull()) {
+            std::cout << name << ": " << interp->globals[i].stringify() << std::endl;
+            return;
+        }
+    }
+    std::cout << "Unrecognised variable!" << std::endl;
+}
+
+/// Read commands until one resumes execution.
+void Debugger::prompt(int lineNum) {
+    std::cout << "-- Paused after line " << lineNum << " --" << std::endl;
+    if (interp->outputSymbolTable) {
+        interp->writeSymbolTable();
+    }
+    std::string input;
+    while (std::getline(std::cin, input)) {
+        if (input == "NEXT" || input == "next" || input == "n") {
+            stepMode = STEP_OVER;
+            stepDepth = callDepth;
+            return;
+        } else if (input == "step" || input == "s") {
+            stepMode = STEP_INTO;
+            return;
+        } else if (input == "continue" || input == "c") {
+            stepMode = STEP_RUN;
+            return;
+        } else if (input == "sym") {
+            interp->writeSymbolTable();
+        } else if (input.compare(0, 6, "print ") == 0) {
+            printVariable(input.substr(6));
+        } else {
+            std::cout << "Commands: next, step, continue, sym, print <variable>" << std::endl;
+        }
+    }
+    // Input closed, run the rest of the program without stopping
+    stepMode = STEP_RUN;
+    hooks = false;
+}
+
+/// Hook run after every statement while hooks is set.
+void Debugger::statement(int lineNum) {
+    bool pause = false;
+    if (stepMode == STEP_INTO || (stepMode == STEP_OVER && callDepth <= stepDepth)) {
+        pause = true;
+    } else if (lineNum < (int)breakpointLines.size() && breakpointLines[lineNum]) {
+        pause = conditionMet(lineNum);
+    }
+    if (pause) {
+        prompt(lineNum);
+    }
+}
+
+void Debugger::enterSub() {
+    callDepth++;
+}
+
+void Debugger::exitSub() {
+    callDepth--;
+}
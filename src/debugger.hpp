@@ -0,0 +1,44 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "node.hpp"
+
+class Interpreter;
+
+/// Pauses a program at breakpoints or after each step and reads
+/// commands from stdin. Each Interpreter has its own.
+class Debugger {
+public:
+    // Set when --debug or any breakpoint is given. The evaluator and VM
+    // only call into the debugger when it is, so normal runs pay nothing.
+    bool hooks;
+
+    Debugger(Interpreter *interp);
+    void addBreakpoint(int lineNum, Node *condition);
+    void start(bool stepFromStart);
+    void statement(int lineNum);
+    void enterSub();
+    void exitSub();
+
+private:
+    /// How execution continues after the debugger resumes.
+    enum StepMode {
+        STEP_RUN,  // Run until the next breakpoint
+        STEP_INTO, // Stop after the next statement, inside Subs too
+        STEP_OVER  // Stop after the next statement at this call depth or above
+    };
+
+    Interpreter *interp;
+    std::vector<bool> breakpointLines; // Indexed by line number
+    std::map<int, Node*> conditions;   // Optional condition per line
+    StepMode stepMode;
+    int callDepth;
+    int stepDepth;
+
+    bool conditionMet(int lineNum);
+    void printVariable(const std::string &name);
+    void prompt(int lineNum);
+};
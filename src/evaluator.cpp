@@ -1,95 +1,25 @@
 #include "evaluator.hpp"
+#include "interpreter.hpp"
 #include "builtin.hpp"
+#include "output.hpp"
 
-// External dependencies
-extern std::map<std::string, Value*> env; // Variables
-extern bool runDebug;                     // Debug run
-extern bool outputSymbolTable;            // Output the symbol table
-extern std::vector<int> breakpoints;      // List of breakpoints
-
-// Global helpers
-int currentLineNum = -1;
-std::map<std::string, SubNode*> funcs;    // User defined subroutines
-std::map<std::string, Builtin*> builtins; // Small Basic standard lib
-
-Value *evProgram(ProgramNode *program);
-Value *evPrint(PrintNode *print);
-Value *evBinaryOp(BinaryOpNode *binaryOp);
-Value *evUnaryOp(UnaryOpNode *unaryOp);
-Value *evVarAssign(VarAssignNode *varAssign);
-Value *evIdentifier(IdentifierNode *identifier);
-Value *evIf(IfNode *ifNode);
-Value *evBlock(BlockNode *block);
-Value *evWhile(WhileNode *whileNode);
-Value *evFor(ForNode *forNode);
-Value *evSub(SubNode *subNode);
-Value *evCall(CallNode *callNode);
-Value *evExprList(ExprListNode *listNode);
-Value *evMap(MapNode *map);
-Value *evIndex(IndexNode *idx);
-Value *evIndexAssign(IndexAssignNode *idx);
-Value *evBuiltin(BuiltInNode *b);
-Value *evExprNode(ExprNode *e);
-
-/// Assert that the value pointer given is not NULL
-Value *assertValue(Node *node, Value *v) {
-    if (v == NULL) {
-        return new ErrorValue(node->lineNum, "Expected a value and received NULL!");
-    }
-
-    return v;
-}
+#include <pthread.h>
 
-/// Helper to print the symbol table to stdout
-void writeSymbolTable() {
-    std::cout << "-- Symbol Table Start --" << std::endl;
-    for (auto it = env.begin(); it != env.end(); it++) {
-        std::string name = it->first;
-        Value *v = it->second;
-        std::cout << name << ": " << v->stringify() << std::endl;
-    }
-    std::cout << "-- Symbol Table End --" << std::endl;
-}
+// Iteration numbers of a Parallel For stay exact doubles up to here
+#define MAX_PARALLEL_ITERATIONS 9007199254740992.0
 
-/// Debug mode function to pause and wait for user input at
-/// breakpoints
-void debugModeFunc() {
-    bool isAtBreakPoint = std::find(breakpoints.begin(), breakpoints.end(), currentLineNum) != breakpoints.end();
-    if (runDebug && !isAtBreakPoint) {
-        return;
+/// Assert that the value given is not NULL
+Value assertValue(Node *node, Value v) {
+    if (v.isNull()) {
+        return makeError(node->lineNum, "Expected a value and received NULL!");
     }
 
-    if (runDebug || isAtBreakPoint) {
-        if (outputSymbolTable) {
-            writeSymbolTable();
-        }
-
-        std::string input = "";
-        while (input != "NEXT") {
-            std::getline(std::cin, input);
-        }
-    }
-}
-
-/// Helper to register all the standard library
-void registerBuiltins() {
-    builtins["random"] = new Random();
-    builtins["input"] = new ReadLine();
-    builtins["floor"] = new Floor();
-    builtins["ceil"] = new Ceil();
-    builtins["pi"] = new Pi();
-    builtins["readfile"] = new ReadFile();
-    builtins["len"] = new Len();
-    builtins["sqrt"] = new Sqrt();
-    builtins["cos"] = new Cos();
-    builtins["sin"] = new Sin();
-    builtins["tan"] = new Tan();
+    return v;
 }
 
 /// Root entry point, takes a given node checks its type and evaluates
-/// it accordingly. Sets currentLineNum.
-Value *ev(Node *root) {
-    currentLineNum = root->lineNum;
+/// it accordingly.
+Value Interpreter::ev(Node *root) {
     switch (root->type) {
         case NODE_PROGRAM:
             return evProgram(dynamic_cast<ProgramNode*>(root));
@@ -129,56 +59,75 @@ Value *ev(Node *root) {
             return evIndex(dynamic_cast<IndexNode*>(root));
         case NODE_INDEX_ASSIGN:
             return evIndexAssign(dynamic_cast<IndexAssignNode*>(root));
-        case NODE_BUILTIN:
-            return evBuiltin(dynamic_cast<BuiltInNode*>(root));
         case NODE_EXPR:
             return evExprNode(dynamic_cast<ExprNode*>(root));
+        case NODE_VAR_DECL:
+            return evVarDecl(dynamic_cast<VarDeclNode*>(root));
+        case NODE_RETURN:
+            return evReturn(dynamic_cast<ReturnNode*>(root));
         default:
-            return new ErrorValue(root->lineNum, "Unrecognised node type!");
+            return makeError(root->lineNum, "Unrecognised node type!");
     }
-    return NULL;
+    return Value::null();
 }
 
 /// Helper function to evaluate a program node.
 /// Simply evaluates every statement contained in the node.
-Value *evProgram(ProgramNode *program) {
-    std::vector<Node*> *stmts = program->getStmts();
-    for (int i = 0; i < stmts->size(); i++) {
+Value Interpreter::evProgram(ProgramNode *program) {
+    NodeList *stmts = program->getStmts();
+    for (size_t i = 0; i < stmts->size(); i++) {
         Node *node = (*stmts)[i];
-        Value *curr = ev(node);
+        if (runProfile) {
+            profiler.line(node->lineNum);
+        }
+        Value curr = ev(node);
         if (isError(curr)) {
             return curr;
         }
-        debugModeFunc();
+        if (debugger.hooks) {
+            debugger.statement(node->lineNum);
+        }
     }
-    return NULL;
+    return Value::null();
 }
 
 /// Helper function to evaluate a print node.
 /// Simply prints the expr value to stdout.
-Value *evPrint(PrintNode *print) {
-    Value *val = assertValue(print, ev(print->exp));
+Value Interpreter::evPrint(PrintNode *print) {
+    Value val = assertValue(print, ev(print->exp));
     if (isError(val)) {
         return val;
     }
-    std::cout << val->stringify() << std::endl;
-    return NULL;
+    printValue(val);
+    return Value::null();
 }
 
 /// Helper to check for equality across SmallBasic
 /// values. Returns true if they are equal.
-bool isEqual(Value *left, Value *right) {
-    if (left->type != right->type) {
+bool isEqual(const Value &left, const Value &right) {
+    if (left.bits == right.bits && !left.isNumber()) {
+        // Same boolean, same small string or same heap object
+        return true;
+    }
+
+    ValueType type = left.type();
+    if (type != right.type()) {
         return false;
     }
 
-    switch (left->type) {
+    switch (type) {
         case VAL_BOOL:
-            return dynamic_cast<BoolValue*>(left)->boolean == dynamic_cast<BoolValue*>(right)->boolean;
-        case VAL_STRING:
-            return (strcmp(dynamic_cast<StringValue*>(left)->string, dynamic_cast<StringValue*>(right)->string)) == 0;
+            return left.asBool() == right.asBool();
+        case VAL_STRING: {
+            if (isInterned(left) && isInterned(right)) {
+                return false; // Distinct pool entries
+            }
+            StringRef l(left);
+            StringRef r(right);
+            return l.size() == r.size() && memcmp(l.data(), r.data(), l.size()) == 0;
+        }
         case VAL_NUMBER:
-            return dynamic_cast<NumberValue*>(left)->number == dynamic_cast<NumberValue*>(right)->number;
+            return left.asNumber() == right.asNumber();
         default:
             // Unreachable
             break;
@@ -188,155 +137,240 @@ bool isEqual(Value *left, Value *right) {
 
 /// Helper to check if a value is truthy.
 /// AKA a value evaluates to true.
-bool isTruthy(Value *v) {
-    if (v->type == VAL_BOOL) {
-        return dynamic_cast<BoolValue*>(v)->boolean;
+bool isTruthy(const Value &v) {
+    if (v.isNull()) {
+        return false;
     }
 
-    if (v == NULL) {
-        return false;
+    if (v.isBool()) {
+        return v.asBool();
     }
+
     // All other types truthy as we dont have a null
     return true;
 }
 
+/// Helper to concatenate two string values, the result
+/// is packed inline when it is short enough. When the left
+/// string ends at the end of its buffer the right is appended
+/// in place and the result shares the buffer, so building a
+/// string with s = s + x is linear overall.
+Value concatStrings(const Value &left, const Value &right) {
+    if (left.isObject()) {
+        StringValue *ls = left.as<StringValue>();
+        bool sameBuffer = right.isObject() && right.as<StringValue>()->buffer == ls->buffer;
+        if (ls->ownsTail() && !sameBuffer) {
+            StringRef r(right);
+            ls->append(r.data(), r.size());
+            return Value::object(new StringValue(ls, ls->length + r.size()));
+        }
+    }
+
+    StringRef l(left);
+    StringRef r(right);
+    size_t length = l.size() + r.size();
+    if (length <= Value::SMALL_STRING_MAX) {
+        char buffer[Value::SMALL_STRING_MAX + 1];
+        memcpy(buffer, l.data(), l.size());
+        memcpy(buffer + l.size(), r.data(), r.size());
+        return Value::string(buffer, length);
+    }
+    StringValue *str = new StringValue(length);
+    memcpy(str->chars(), l.data(), l.size());
+    memcpy(str->chars() + l.size(), r.data(), r.size());
+    return Value::object(str);
+}
+
 /// Helper to evaluate the valid binary ops between strings.
 /// Handles all error cases.
-Value *evStringBinaryOp(BinaryOpNode *binaryOp, Value *left, Value *right) {
-    if (right->type != VAL_STRING) {
-        return new ErrorValue(binaryOp->lineNum, "Expected string for right operand as left is string.");
-    }
-    StringValue *strLeft = dynamic_cast<StringValue*>(left);
-    StringValue *strRight = dynamic_cast<StringValue*>(right);
-    char *newStr = (char *)malloc(strlen(strLeft->string) + strlen(strRight->string) + 1);
-    strcpy(newStr, strLeft->string);
-    strcat(newStr, strRight->string);
-    switch (binaryOp->op) {
+Value evStringBinaryOp(char op, int lineNum, const Value &left, const Value &right) {
+    if (!right.isString()) {
+        return makeError(lineNum, "Expected string for right operand as left is string.");
+    }
+    switch (op) {
         case '+':
-            return new StringValue(newStr);
+            return concatStrings(left, right);
         case 'E': // ==
-            return new BoolValue(isEqual(left, right));
+            return Value::boolean(isEqual(left, right));
         case 'A': // and
-            return new BoolValue(isTruthy(left) && isTruthy(right));
+            return Value::boolean(isTruthy(left) && isTruthy(right));
         case 'O':
-            return new BoolValue(isTruthy(left) || isTruthy(right));
+            return Value::boolean(isTruthy(left) || isTruthy(right));
         default:
-            return new ErrorValue(binaryOp->lineNum, "Unsupported operator between strings!");
+            return makeError(lineNum, "Unsupported operator between strings!");
     }
 }
 
 /// Helper to evaluate the valid binary ops between numbers.
 /// Handles all error cases.
-Value *evNumberBinaryOp(BinaryOpNode *binaryOp, Value *left, Value *right) {
-    if (right->type != VAL_NUMBER) {
-        return new ErrorValue(binaryOp->lineNum, "Expected number for right operand as left is number.");
+Value evNumberBinaryOp(char op, int lineNum, const Value &left, const Value &right) {
+    if (!right.isNumber()) {
+        return makeError(lineNum, "Expected number for right operand as left is number.");
     }
 
-    switch (binaryOp->op) {
+    double l = left.asNumber();
+    double r = right.asNumber();
+    switch (op) {
         case '+':
-            return new NumberValue(dynamic_cast<NumberValue*>(left)->number + dynamic_cast<NumberValue*>(right)->number);
+            return Value::number(l + r);
         case '-':
-            return new NumberValue(dynamic_cast<NumberValue*>(left)->number - dynamic_cast<NumberValue*>(right)->number);
+            return Value::number(l - r);
         case '*':
-            return new NumberValue(dynamic_cast<NumberValue*>(left)->number * dynamic_cast<NumberValue*>(right)->number);
+            return Value::number(l * r);
         case '/':
-            return new NumberValue(dynamic_cast<NumberValue*>(left)->number / dynamic_cast<NumberValue*>(right)->number);
+            return Value::number(l / r);
         case '<':
-            return new BoolValue(dynamic_cast<NumberValue*>(left)->number < dynamic_cast<NumberValue*>(right)->number);
+            return Value::boolean(l < r);
         case '>':
-            return new BoolValue(dynamic_cast<NumberValue*>(left)->number > dynamic_cast<NumberValue*>(right)->number);
+            return Value::boolean(l > r);
         case 'L': // <=
-            return new BoolValue(dynamic_cast<NumberValue*>(left)->number <= dynamic_cast<NumberValue*>(right)->number);
+            return Value::boolean(l <= r);
         case 'G': // >=
-            return new BoolValue(dynamic_cast<NumberValue*>(left)->number >= dynamic_cast<NumberValue*>(right)->number);
+            return Value::boolean(l >= r);
         case 'E': // ==
-            return new BoolValue(isEqual(left, right));
+            return Value::boolean(l == r);
         case 'A': // and
-            return new BoolValue(isTruthy(left) && isTruthy(right));
+            return Value::boolean(isTruthy(left) && isTruthy(right));
         case 'O': // or
-            return new BoolValue(isTruthy(left) || isTruthy(right));
+            return Value::boolean(isTruthy(left) || isTruthy(right));
         default:
-            return new ErrorValue(binaryOp->lineNum, "Unsupported operator between numbers!");
+            return makeError(lineNum, "Unsupported operator between numbers!");
     }
 }
 
-/// Evaluates all binary operations between two values.
-Value *evBinaryOp(BinaryOpNode *binaryOp) {
-    Value *left = assertValue(binaryOp, ev(binaryOp->left));
-    Value *right = ev(binaryOp->right);
-
-    if (isError(left)) {
-        return left;
+/// Applies a binary operator to two already evaluated values.
+/// Shared by the tree walker and the bytecode VM.
+Value applyBinaryOp(char op, int lineNum, const Value &left, const Value &right) {
+    if (left.isNull() || right.isNull()) {
+        return makeError(lineNum, "Expected a value and received NULL!");
     }
 
-    if (isError(right)) {
-        return right;
-    }
-
-    if (left->type == VAL_STRING) {
-        return evStringBinaryOp(binaryOp, left, right);
-    } else if (left->type == VAL_NUMBER) {
-        return evNumberBinaryOp(binaryOp, left, right);
+    if (left.isNumber()) {
+        return evNumberBinaryOp(op, lineNum, left, right);
+    } else if (left.isString()) {
+        return evStringBinaryOp(op, lineNum, left, right);
     } else {
-        switch (binaryOp->op) {
+        switch (op) {
             case 'E': // ==
-                return new BoolValue(isEqual(left, right));
+                return Value::boolean(isEqual(left, right));
             case 'A': // and
-                return new BoolValue(isTruthy(left) && isTruthy(right));
+                return Value::boolean(isTruthy(left) && isTruthy(right));
             case 'O':
-                return new BoolValue(isTruthy(left) || isTruthy(right));
+                return Value::boolean(isTruthy(left) || isTruthy(right));
             default:
-                return new ErrorValue(binaryOp->lineNum, "Unrecognised binary operator!");
+                return makeError(lineNum, "Unrecognised binary operator!");
         }
     }
 }
 
-/// Evaluates all unary operations on a value.
-Value *evUnaryOp(UnaryOpNode *unaryOp) {
-    Value *right = ev(unaryOp->right);
-    if (right->type != VAL_NUMBER) {
-        return new ErrorValue(unaryOp->lineNum, "Unary operators only support numbers!");
+/// Evaluates all binary operations between two values.
+/// Generated code can chain many thousands of operators down
+/// the left operand, so a chain is collected on chainStack and
+/// applied from the innermost operator out instead of recursing.
+Value Interpreter::evBinaryOp(BinaryOpNode *binaryOp) {
+    if (binaryOp->left->type != NODE_BINARY_OP) {
+        Value left = assertValue(binaryOp, ev(binaryOp->left));
+        Value right = ev(binaryOp->right);
+
+        if (isError(left)) {
+            return left;
+        }
+
+        if (isError(right)) {
+            return right;
+        }
+
+        return applyBinaryOp(binaryOp->op, binaryOp->lineNum, left, right);
     }
 
-    switch (unaryOp->op) {
+    // Indexed rather than iterated as evaluating an operand may
+    // push a chain of its own and grow the stack
+    size_t base = chainStack.size();
+    Node *innermost = binaryOp;
+    while (innermost->type == NODE_BINARY_OP) {
+        chainStack.push_back(dynamic_cast<BinaryOpNode*>(innermost));
+        innermost = chainStack.back()->left;
+    }
+    Value left = ev(innermost);
+    for (size_t i = chainStack.size(); i-- > base;) {
+        BinaryOpNode *op = chainStack[i];
+        left = assertValue(op, left);
+        Value right = ev(op->right);
+        if (!isError(left)) {
+            left = isError(right) ? right : applyBinaryOp(op->op, op->lineNum, left, right);
+        }
+    }
+    chainStack.resize(base);
+    return left;
+}
+
+/// Applies a unary operator to an already evaluated value.
+Value applyUnaryOp(char op, int lineNum, const Value &right) {
+    if (!right.isNumber()) {
+        return makeError(lineNum, "Unary operators only support numbers!");
+    }
+
+    switch (op) {
         case '-':
-            return new NumberValue(-(dynamic_cast<NumberValue*>(right)->number));
+            return Value::number(-right.asNumber());
         default:
-            return new ErrorValue(unaryOp->lineNum, "Unrecognised unary operator!");
+            return makeError(lineNum, "Unrecognised unary operator!");
     }
 
-    return NULL;
+    return Value::null();
+}
+
+/// Evaluates all unary operations on a value.
+Value Interpreter::evUnaryOp(UnaryOpNode *unaryOp) {
+    Value right = ev(unaryOp->right);
+    if (isError(right)) {
+        return right;
+    }
+
+    return applyUnaryOp(unaryOp->op, unaryOp->lineNum, right);
 }
 
 /// Evaluates a variable assignment node setting
 /// its value in the env map on success.
-Value *evVarAssign(VarAssignNode *varAssign) {
-    std::string ident = dynamic_cast<IdentifierNode*>(varAssign->ident)->ident;
-    Value *v = ev(varAssign->value);
+Value Interpreter::evVarAssign(VarAssignNode *varAssign) {
+    Value v = ev(varAssign->value);
     if (isError(v)) {
         return v;
     }
-    env[ident] = v;
+    IdentifierNode *ident = dynamic_cast<IdentifierNode*>(varAssign->ident);
+    if (inParallelFor && !ident->local) {
+        return makeError(varAssign->lineNum, "Subs called from a Parallel For cannot assign globals!");
+    }
+    variable(ident) = v;
     
-    return NULL;
+    return Value::null();
+}
+
+/// Evaluates a Var declaration, inside a Sub the
+/// variable is one of its locals.
+Value Interpreter::evVarDecl(VarDeclNode *varDecl) {
+    Value v = ev(varDecl->value);
+    if (isError(v)) {
+        return v;
+    }
+    variable(dynamic_cast<IdentifierNode*>(varDecl->ident)) = v;
+    return Value::null();
 }
 
 /// Evaluates an identifier node looking up its value
-/// in the variable map.
-Value *evIdentifier(IdentifierNode *identifier) {
-    std::string ident = identifier->ident;
-    if (env.find(ident) == env.end()) {
-        return new ErrorValue(identifier->lineNum, "Unrecognised variable!");
+/// by its resolved slot.
+Value Interpreter::evIdentifier(IdentifierNode *identifier) {
+    const Value &v = variable(identifier);
+    if (v.isNull()) {
+        return makeError(identifier->lineNum, "Unrecognised variable!");
     }
-    Value *v = env[ident];
     return v;
 }
 
 /// Evaluates an if statement, processing the expr
 /// and handling what branch to execute accordingly.
-Value *evIf(IfNode *ifNode) {
-    Value *v = NULL;
-    v = ev(ifNode->expr);
+Value Interpreter::evIf(IfNode *ifNode) {
+    Value v = ev(ifNode->expr);
     if (isError(v)) {
         return v;
     }
@@ -348,127 +382,418 @@ Value *evIf(IfNode *ifNode) {
         }
     }
 
-    if (isError(v)) {
+    if (isError(v) || returning) {
         return v;
     }
 
-    return NULL;
+    return Value::null();
 }
 
 /// Evaluates a block statement, simply iterates
 /// over contained statements and executes each.
-Value *evBlock(BlockNode *block) {
-    std::vector<Node*> *stmts = block->getStmts();
-    for (int i = 0; i < stmts->size(); i++) {
+Value Interpreter::evBlock(BlockNode *block) {
+    NodeList *stmts = block->getStmts();
+    for (size_t i = 0; i < stmts->size(); i++) {
         Node *stmt = (*stmts)[i];
-        Value *v = ev(stmt);
-        if (isError(v)) {
+        if (runProfile) {
+            profiler.line(stmt->lineNum);
+        }
+        Value v = ev(stmt);
+        if (isError(v) || returning) {
             return v;
         }
-        debugModeFunc();
+        if (debugger.hooks) {
+            debugger.statement(stmt->lineNum);
+        }
     }
-    return NULL;
+    return Value::null();
 }
 
 /// Evaluate a while statement, while the expr
 /// is true evaluate the block.
-Value *evWhile(WhileNode *whileNode) {
-    while(isTruthy(ev(whileNode->expr))) {
-        Value *v = ev(whileNode->block);
-        if (isError(v)) {
+Value Interpreter::evWhile(WhileNode *whileNode) {
+    while (true) {
+        Value cond = ev(whileNode->expr);
+        if (isError(cond)) {
+            return cond;
+        }
+        if (!isTruthy(cond)) {
+            break;
+        }
+        Value v = ev(whileNode->block);
+        if (isError(v) || returning) {
             return v;
         }
+        if (runProfile) {
+            profiler.line(whileNode->lineNum);
+        }
     }
-    return NULL;
+    return Value::null();
 }
 
 /// Evaluate both types of for statements, handling
 /// the increment and stop conditions.
-Value *evFor(ForNode *forNode) {
-    IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(forNode->ident);
-    std::string ident = identNode->ident;
-    Value *v = ev(forNode->value);
-    if (v == NULL || v->type != VAL_NUMBER) {
-        return new ErrorValue(forNode->lineNum, "For initialiser must be a number!");
-    }
-    env[ident] = v;
-    Value *max = ev(forNode->max);
-    if (max == NULL || max->type != VAL_NUMBER) {
-        return new ErrorValue(forNode->lineNum, "For maximum must be a number!");
-    }
-    NumberValue *v2 = dynamic_cast<NumberValue*>(v);
-    NumberValue *max2 = dynamic_cast<NumberValue*>(max);
+Value Interpreter::evFor(ForNode *forNode) {
+    if (forNode->parallel) {
+        return evParallelFor(forNode);
+    }
+    IdentifierNode *ident = dynamic_cast<IdentifierNode*>(forNode->ident);
+    Value v = ev(forNode->value);
+    if (!v.isNumber()) {
+        return makeError(forNode->lineNum, "For initialiser must be a number!");
+    }
+    if (inParallelFor && !ident->local) {
+        return makeError(forNode->lineNum, "Subs called from a Parallel For cannot assign globals!");
+    }
+    variable(ident) = v;
+    Value max = ev(forNode->max);
+    if (!max.isNumber()) {
+        return makeError(forNode->lineNum, "For maximum must be a number!");
+    }
+    double step = 1;
     if (forNode->step != NULL) {
-        Value *step = ev(forNode->step);
-        if (step == NULL || step->type != VAL_NUMBER) {
-            return new ErrorValue(forNode->lineNum, "For step must be a number!");
-        }
-        NumberValue *step2 = dynamic_cast<NumberValue*>(step);
-        for (v2->number; v2->number < max2->number; v2->number = v2->number + step2->number) {
-            Value *v = ev(forNode->block);
-            if (isError(v)) {
-                return v;
-            }
+        Value stepValue = ev(forNode->step);
+        if (!stepValue.isNumber()) {
+            return makeError(forNode->lineNum, "For step must be a number!");
         }
-    } else {
-        for (v2->number; v2->number < max2->number; v2->number++) {
-            Value *v = ev(forNode->block);
-            if (isError(v)) {
-                return v;
-            }
+        step = stepValue.asNumber();
+    }
+    // The counter, bound and step stay unboxed for the whole loop,
+    // the body is run through evBlock directly without dispatch.
+    BlockNode *block = dynamic_cast<BlockNode*>(forNode->block);
+    double start = v.asNumber();
+    double limit = max.asNumber();
+    double counter = start;
+    for (double i = 1; forContinues(counter, limit, step); i++) {
+        Value result = evBlock(block);
+        if (isError(result) || returning) {
+            return result;
+        }
+        if (runProfile) {
+            profiler.line(forNode->lineNum);
         }
+        counter = forCounter(start, step, i);
+        variable(ident) = Value::number(counter);
     }
 
-    return NULL;
+    return Value::null();
 }
 
-/// Evaluate a subroutine definition node storing the 
-/// subroutine in the funcs map.
-Value *evSub(SubNode *subNode) {
-    IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(subNode->ident);
-    std::string ident = identNode->ident;
-    funcs[ident] = subNode;
-    return NULL;
+/// Check the bounds of a Parallel For and that the variables it
+/// sums into hold numbers, then count its iterations. Iteration i
+/// has counter forCounter(start, step, i) so each can work out its
+/// own, and the count is exactly the iterations a For would run.
+/// Shared by the tree walker and the bytecode VM.
+Value Interpreter::prepareParallelFor(int lineNum, const Value &start, const Value &limit, const Value &step,
+                         const std::vector<uint32_t> &sums, size_t &count) {
+    if (!start.isNumber()) {
+        return makeError(lineNum, "For initialiser must be a number!");
+    }
+    if (!limit.isNumber()) {
+        return makeError(lineNum, "For maximum must be a number!");
+    }
+    if (!step.isNumber()) {
+        return makeError(lineNum, "For step must be a number!");
+    }
+    if (step.asNumber() == 0) {
+        return makeError(lineNum, "Parallel For step cannot be 0!");
+    }
+    for (size_t i = 0; i < sums.size(); i++) {
+        if (!globals[sums[i]].isNumber()) {
+            return makeError(lineNum, "Parallel For sums must start as numbers!");
+        }
+    }
+    count = 0;
+    double first = start.asNumber();
+    double bound = limit.asNumber();
+    double by = step.asNumber();
+    if (forContinues(first, bound, by)) {
+        // Estimate by dividing, then settle the rounding against
+        // the same test the For loop makes
+        double estimate = ceil((bound - first) / by);
+        if (!(estimate <= MAX_PARALLEL_ITERATIONS)) {
+            return makeError(lineNum, "Parallel For has too many iterations!");
+        }
+        count = (size_t)estimate;
+        while (count > 0 && !forContinues(forCounter(first, by, count - 1), bound, by)) {
+            count--;
+        }
+        while (forContinues(forCounter(first, by, count), bound, by)) {
+            count++;
+        }
+    }
+    return Value::null();
+}
+
+/// Add the sums one iteration left in its frame, after the
+/// counter, to totals. Errors unless each is still a number.
+Value addIterationSums(int lineNum, const Value *frame, std::vector<double> &totals) {
+    for (size_t i = 0; i < totals.size(); i++) {
+        const Value &sum = frame[1 + i];
+        if (!sum.isNumber()) {
+            return makeError(lineNum, "Parallel For sums must hold numbers!");
+        }
+        totals[i] += sum.asNumber();
+    }
+    return Value::null();
+}
+
+/// Add the totals of a finished Parallel For to the variables
+/// it sums into.
+void Interpreter::finishParallelFor(const std::vector<uint32_t> &sums, const std::vector<double> &totals) {
+    for (size_t i = 0; i < sums.size(); i++) {
+        globals[sums[i]] = Value::number(globals[sums[i]].asNumber() + totals[i]);
+    }
+}
+
+/// Mark everything reachable from the globals as shared before
+/// Parallel For iterations start, and unmark it once they end.
+/// Iterations may set elements of shared lists, but cannot change
+/// their length, slice them, assign into shared maps or read from
+/// shared files. The tree walker marks them too so both give the
+/// same errors.
+void Interpreter::shareGlobals(bool shared) {
+    for (size_t i = 0; i < globals.size(); i++) {
+        shareValue(globals[i], shared);
+    }
+}
+
+/// Global slots of the variables a Parallel For sums into.
+std::vector<uint32_t> parallelSums(ForNode *forNode) {
+    std::vector<uint32_t> slots;
+    ExprListNode *sums = dynamic_cast<ExprListNode*>(forNode->sums);
+    for (size_t i = 0; sums != NULL && i < sums->exprs.size(); i++) {
+        slots.push_back(dynamic_cast<IdentifierNode*>(sums->exprs[i])->slot);
+    }
+    return slots;
+}
+
+/// Evaluate a Parallel For. The tree walker runs the iterations
+/// in order, each in a fresh frame of the loop's body as for a
+/// Sub call, so its results match the VM's.
+Value Interpreter::evParallelFor(ForNode *forNode) {
+    Value start = ev(forNode->value);
+    if (isError(start)) {
+        return start;
+    }
+    Value limit = ev(forNode->max);
+    if (isError(limit)) {
+        return limit;
+    }
+    Value step = forNode->step != NULL ? ev(forNode->step) : Value::number(1);
+    if (isError(step)) {
+        return step;
+    }
+    std::vector<uint32_t> sums = parallelSums(forNode);
+    size_t count;
+    Value error = prepareParallelFor(forNode->lineNum, start, limit, step, sums, count);
+    if (!error.isNull()) {
+        return error;
+    }
+    SubNode *body = forNode->body;
+    BlockNode *block = dynamic_cast<BlockNode*>(body->block);
+    std::vector<double> totals(sums.size(), 0);
+    size_t base = frameStack.size();
+    size_t callerBase = frameBase;
+    frameBase = base;
+    inParallelFor = true;
+    shareGlobals(true);
+    for (size_t i = 0; i < count && error.isNull(); i++) {
+        frameStack.resize(base);
+        frameStack.resize(base + body->numLocals);
+        frameStack[base] = Value::number(forCounter(start.asNumber(), step.asNumber(), i));
+        for (size_t j = 0; j < sums.size(); j++) {
+            frameStack[base + 1 + j] = Value::number(0);
+        }
+        Value v = evBlock(block);
+        error = isError(v) ? v : addIterationSums(forNode->lineNum, frameStack.data() + base, totals);
+        if (runProfile) {
+            profiler.line(forNode->lineNum);
+        }
+    }
+    shareGlobals(false);
+    inParallelFor = false;
+    frameBase = callerBase;
+    frameStack.resize(base);
+    if (!error.isNull()) {
+        return error;
+    }
+    finishParallelFor(sums, totals);
+    return Value::null();
+}
+
+/// Evaluate a subroutine definition node. Calls are bound
+/// to their Sub by the resolver so there is nothing to do.
+Value Interpreter::evSub(SubNode *subNode) {
+    return Value::null();
+}
+
+/// Bytes of native stack Sub calls may use under the tree
+/// walker, which recurses for every call. Leaves a quarter
+/// of this thread's stack as headroom for nested expressions.
+static size_t stackBudget() {
+    static thread_local size_t budget = 0;
+    if (budget == 0) {
+        size_t size = 8 << 20;
+        pthread_attr_t attr;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            pthread_attr_getstacksize(&attr, &size);
+            pthread_attr_destroy(&attr);
+        }
+        budget = size / 4 * 3;
+    }
+    return budget;
+}
+
+/// Run a Sub whose arguments are the top of the frame stack
+/// from base. The rest of its locals start out unassigned.
+/// Errors instead of overflowing the native stack when calls
+/// nest too deep.
+Value Interpreter::callSub(SubNode *sub, size_t base, int lineNum) {
+    char marker;
+    if (callDepth == 0) {
+        stackBase = &marker;
+    }
+    if (callDepth >= maxCallDepth) {
+        frameStack.resize(base);
+        return makeError(lineNum, "Maximum call depth exceeded!");
+    }
+    if ((size_t) (stackBase - &marker) > stackBudget()) {
+        frameStack.resize(base);
+        return makeError(lineNum, "Recursion too deep for the tree walker, try without --tree!");
+    }
+    callDepth++;
+    size_t callerBase = frameBase;
+    frameBase = base;
+    if (runProfile) {
+        profiler.enterSub(dynamic_cast<IdentifierNode*>(sub->ident)->ident);
+    }
+    if (debugger.hooks) {
+        debugger.enterSub();
+    }
+    Value v;
+    while (true) {
+        frameStack.resize(base + sub->numLocals);
+        v = evBlock(dynamic_cast<BlockNode*>(sub->block));
+        if (tailCall == NULL) {
+            break;
+        }
+        // A tail call left its arguments at the start of this
+        // frame, run the callee in place of this Sub
+        sub = tailCall;
+        tailCall = NULL;
+        returning = false;
+        if (runProfile) {
+            profiler.exitSub();
+            profiler.enterSub(dynamic_cast<IdentifierNode*>(sub->ident)->ident);
+        }
+    }
+    if (debugger.hooks) {
+        debugger.exitSub();
+    }
+    if (runProfile) {
+        profiler.exitSub();
+    }
+    callDepth--;
+    frameBase = callerBase;
+    frameStack.resize(base);
+    if (returning) {
+        returning = false;
+        return v;
+    }
+    return isError(v) ? v : Value::null();
+}
+
+/// Evaluate a call to a Sub or builtin. The arguments are
+/// pushed on the frame stack, for a Sub they become the
+/// first of its locals and a builtin gets a view of them.
+Value Interpreter::evCall(CallNode *callNode) {
+    ExprListNode *args = dynamic_cast<ExprListNode*>(callNode->args);
+    size_t base = frameStack.size();
+    for (size_t i = 0; i < args->exprs.size(); i++) {
+        Value v = ev(args->exprs[i]);
+        if (v.isNull() || isError(v)) {
+            frameStack.resize(base);
+            return v.isNull() ? makeError(callNode->lineNum, "Cannot have a statement as an arguement!") : v;
+        }
+        frameStack.push_back(v);
+    }
+    if (callNode->sub != NULL) {
+        return callSub(callNode->sub, base, callNode->lineNum);
+    }
+    Value result = callNode->builtin->execute(callNode->lineNum, ArgList(frameStack.data() + base, args->exprs.size()));
+    frameStack.resize(base);
+    return result;
 }
 
-/// Evaluate a subroutine call node, simply evaluates
-/// the subroutine's block.
-Value *evCall(CallNode *callNode) {
-    IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(callNode->ident);
-    std::string ident = identNode->ident;
-    if (funcs.find(ident) == funcs.end()) {
-        return new ErrorValue(callNode->lineNum, "Could not find sub with that identifier");
+/// Evaluate a Return, the value is handed back through
+/// the enclosing blocks to the Sub's call.
+Value Interpreter::evReturn(ReturnNode *ret) {
+    Value v = Value::null();
+    if (ret->value != NULL && ret->value->type == NODE_CALL && dynamic_cast<CallNode*>(ret->value)->sub != NULL) {
+        return evTailCall(dynamic_cast<CallNode*>(ret->value));
     }
-    SubNode *func = funcs[ident];
-    return ev(func->block);
+    if (ret->value != NULL) {
+        v = ev(ret->value);
+        if (isError(v)) {
+            return v;
+        }
+    }
+    returning = true;
+    return v;
+}
+
+/// Evaluate a Return of a Sub call. The arguments replace the
+/// current frame and callSub runs the callee in its place, so
+/// tail recursion does not grow either stack.
+Value Interpreter::evTailCall(CallNode *callNode) {
+    ExprListNode *args = dynamic_cast<ExprListNode*>(callNode->args);
+    size_t top = frameStack.size();
+    for (size_t i = 0; i < args->exprs.size(); i++) {
+        Value v = ev(args->exprs[i]);
+        if (v.isNull() || isError(v)) {
+            frameStack.resize(top);
+            return v.isNull() ? makeError(callNode->lineNum, "Cannot have a statement as an arguement!") : v;
+        }
+        frameStack.push_back(v);
+    }
+    for (size_t i = 0; i < args->exprs.size(); i++) {
+        frameStack[frameBase + i] = frameStack[top + i];
+    }
+    frameStack.resize(frameBase + args->exprs.size());
+    tailCall = callNode->sub;
+    returning = true;
+    return Value::null();
 }
 
 /// Evaluate a list of expressions, returning them as
 /// a Small Basic ListValue.
-Value *evExprList(ExprListNode *listNode) {
+Value Interpreter::evExprList(ExprListNode *listNode) {
     ListValue *v = new ListValue();
-    for (int i = 0; i < listNode->exprs.size(); i++) {
+    Value result = Value::object(v);
+    for (size_t i = 0; i < listNode->exprs.size(); i++) {
         Node *expr = listNode->exprs[i];
-        Value *eved = ev(expr);
+        Value eved = ev(expr);
         if (isError(eved)) {
             return eved;
         }
         v->addValue(eved);
     }
 
-    return v;
+    return result;
 }
 
 /// Evaluate a map node, storing them in a 
 /// Small Basic MapValue.
-Value *evMap(MapNode *map) {
+Value Interpreter::evMap(MapNode *map) {
     MapValue *mapVal = new MapValue();
-    std::map<Node*, Node*> m = map->exprs;
+    Value result = Value::object(mapVal);
+    auto &m = map->exprs;
     for (auto it = m.begin(); it != m.end(); it++) {
         Node *key = it->first;
         Node *val = it->second;
-        Value *k = ev(key);
-        Value *v = ev(val);
+        Value k = ev(key);
+        Value v = ev(val);
         if (isError(k)) {
             return k;
         }
@@ -477,108 +802,117 @@ Value *evMap(MapNode *map) {
         }
         mapVal->addValue(k, v);
     }
-    return mapVal;
+    return result;
 }
 
-/// Evaluate an index node, looking up the
-/// identifier and then seeing if it is indexable.
-Value *evIndex(IndexNode *idx) {
-    IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(idx->ident);
-    std::string ident = identNode->ident;
-    Value *v = env[ident];
-    if (v->type == VAL_LIST) {
-        ListValue *v2 = dynamic_cast<ListValue*>(v);
-        Value *i = ev(idx->index);
-        if (i->type != VAL_NUMBER) {
-            return new ErrorValue(idx->lineNum, "Lists are only indexable by numbers!");
-        }
-        NumberValue *i2 = dynamic_cast<NumberValue*>(i);
-        return v2->values[int(i2->number)];
-    } else if (v->type == VAL_MAP) {
-        MapValue *v2 = dynamic_cast<MapValue*>(v);
-        Value *i = ev(idx->index);
-        if (isError(i)) {
-            return i;
+/// Index into an already evaluated list or map value.
+/// Shared by the tree walker and the bytecode VM.
+Value indexValue(int lineNum, const Value &v, const Value &i) {
+    ValueType type = v.type();
+    if (type == VAL_LIST) {
+        ListValue *v2 = v.as<ListValue>();
+        if (!i.isNumber()) {
+            return makeError(lineNum, "Lists are only indexable by numbers!");
+        }
+        int finalIndex = i.asNumber();
+        if (finalIndex >= (int)v2->size() || finalIndex < 0) {
+            return makeError(lineNum, "Cannot index outside bounds of list!");
+        }
+        return (*v2)[finalIndex];
+    } else if (type == VAL_MAP) {
+        MapValue *v2 = v.as<MapValue>();
+        if (i.isNull()) {
+            return makeError(lineNum, "Expected a value and received NULL!");
         }
         return v2->getValue(i);
     } else {
-        return new ErrorValue(idx->lineNum, "This identifier cannot be indexed!");
+        return makeError(lineNum, "This identifier cannot be indexed!");
     }
 }
 
-/// Evaluate an index assign node, looking up the
-/// identifier, checking if it is indexable and then
-/// setting accordingly.
-Value *evIndexAssign(IndexAssignNode *idx) {
-    IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(idx->ident);
-    std::string ident = identNode->ident;
-    Value *indexable = env[ident];
-    if (indexable->type == VAL_LIST) {
-        ListValue *v = dynamic_cast<ListValue*>(indexable);
-        Value *i = ev(idx->index);
-        if (i->type != VAL_NUMBER) {
-            return new ErrorValue(idx->lineNum, "Lists are only indexable by numbers!");
-        }
-        NumberValue *i2 = dynamic_cast<NumberValue*>(i);
-        Value *value = ev(idx->value);
-        if (isError(value)) {
-            return value;
-        }
-        int finalIndex = i2->number;
-        if (finalIndex >= v->values.size() || finalIndex < 0) {
-            return new ErrorValue(idx->lineNum, "Cannot index outside bounds of list, use append instead!");
-        }
-        v->values[finalIndex] = value;
-        return NULL;
-    } else if (indexable->type == VAL_MAP) {
-        MapValue *v = dynamic_cast<MapValue*>(indexable);
-        Value *i = ev(idx->index);
-        Value *value = ev(idx->value);
-        if (isError(i)) {
-            return i;
-        }
-        if (isError(value)) {
-            return value;
+/// Set an index of an already evaluated list or map value.
+/// Shared by the tree walker and the bytecode VM.
+Value assignIndex(int lineNum, const Value &indexable, const Value &i, const Value &value) {
+    ValueType type = indexable.type();
+    if (type == VAL_LIST) {
+        ListValue *v = indexable.as<ListValue>();
+        if (!i.isNumber()) {
+            return makeError(lineNum, "Lists are only indexable by numbers!");
+        }
+        int finalIndex = i.asNumber();
+        if (finalIndex >= (int)v->size() || finalIndex < 0) {
+            return makeError(lineNum, "Cannot index outside bounds of list, use append instead!");
+        }
+        v->setValue(finalIndex, value);
+        return Value::null();
+    } else if (type == VAL_MAP) {
+        MapValue *v = indexable.as<MapValue>();
+        if (i.isNull() || value.isNull()) {
+            return makeError(lineNum, "Expected a value and received NULL!");
+        }
+        if (v->shared) {
+            return makeError(lineNum, "Parallel For iterations cannot assign into a shared map!");
         }
         v->addValue(i, value);
-        return NULL;
+        return Value::null();
     } else {
-        return new ErrorValue(idx->lineNum, "This identifier cannot be indexed!");
+        return makeError(lineNum, "This identifier cannot be indexed!");
     }
 }
 
-/// Evaluate a builtin standard library call node
-/// Gathers the arguements, looks up the builtin 
-/// and then returns the value.
-Value *evBuiltin(BuiltInNode *b) {
-    IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(b->ident);
-    ExprListNode *args = dynamic_cast<ExprListNode*>(b->args);
-    std::vector<Value*> valueArgs;
-    for (int i = 0; i < args->exprs.size(); i++) {
-        Node *expr = args->exprs[i];
-        Value *v = ev(expr);
-        if (v == NULL) {
-            return new ErrorValue(b->lineNum, "Cannot have a statement as an arguement!");
-        }
-        if (isError(v)) {
-            return v;
-        }
-        valueArgs.push_back(v);
+/// Evaluate an index node, looking up the
+/// identifier and then seeing if it is indexable.
+Value Interpreter::evIndex(IndexNode *idx) {
+    IdentifierNode *ident = dynamic_cast<IdentifierNode*>(idx->ident);
+    if (variable(ident).isNull()) {
+        return evIdentifier(ident);
+    }
+    Value i = ev(idx->index);
+    if (isError(i)) {
+        return i;
+    }
+    // Looked up after the index as a call may move the frame stack
+    const Value &v = variable(ident);
+    ListValue *list = asList(v);
+    if (list != NULL && i.isNumber() && list->inBounds(i.asNumber())) {
+        return (*list)[(size_t)i.asNumber()];
+    }
+    return indexValue(idx->lineNum, v, i);
+}
+
+/// Evaluate an index assign node, looking up the
+/// identifier, checking if it is indexable and then
+/// setting accordingly.
+Value Interpreter::evIndexAssign(IndexAssignNode *idx) {
+    Value indexable = ev(idx->ident);
+    if (isError(indexable)) {
+        return indexable;
     }
-    std::string ident = identNode->ident;
-    if (builtins.find(ident) == builtins.end()) {
-        return new ErrorValue(b->lineNum, "Could not find builtin with that identifier");
+    Value i = ev(idx->index);
+    if (isError(i)) {
+        return i;
     }
-    Builtin *func = builtins[ident];
-    return func->execute(b->lineNum, &valueArgs);
+    Value value = ev(idx->value);
+    if (isError(value)) {
+        return value;
+    }
+    ListValue *list = asList(indexable);
+    if (list != NULL && i.isNumber() && list->inBounds(i.asNumber())) {
+        list->setValue((size_t)i.asNumber(), value);
+        return Value::null();
+    }
+    return assignIndex(idx->lineNum, indexable, i, value);
 }
 
 /// Evaluate an expression node, simply evaluate the contained
 /// expression.
-Value *evExprNode(ExprNode *e) {
+Value Interpreter::evExprNode(ExprNode *e) {
     if (e->expr != NULL) {
-        ev(e->expr);
+        Value v = ev(e->expr);
+        if (isError(v)) {
+            return v;
+        }
     }
 
-    return NULL;
+    return Value::null();
 }
\ No newline at end of file
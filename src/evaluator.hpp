@@ -4,8 +4,38 @@
 #include <iostream>
 #include <cstring>
 #include <cstdlib>
+#include <string>
+#include <vector>
 #include "node.hpp"
 #include "value.hpp"
 
-Value *ev(Node *root);
-void registerBuiltins();
\ No newline at end of file
+// Value level helpers shared between the tree walker and the VM.
+bool isTruthy(const Value &v);
+
+/// Whether a For loop runs another iteration, the bound is
+/// exclusive and a negative step counts down towards it.
+inline bool forContinues(double counter, double limit, double step) {
+    return step < 0 ? counter > limit : counter < limit;
+}
+
+/// Counter of iteration i of a For loop. Worked out from the start
+/// rather than by adding step each time, so a Parallel For runs the
+/// same iterations as a For and fractional steps do not drift.
+inline double forCounter(double start, double step, double i) {
+    return start + i * step;
+}
+
+/// The list held by a value, or NULL when it is not a list.
+/// Lets list indexing skip the checks in indexValue.
+inline ListValue *asList(const Value &v) {
+    return v.isObject() && v.asObject()->type == VAL_LIST ? v.as<ListValue>() : NULL;
+}
+
+bool isEqual(const Value &left, const Value &right);
+Value concatStrings(const Value &left, const Value &right);
+Value applyBinaryOp(char op, int lineNum, const Value &left, const Value &right);
+Value applyUnaryOp(char op, int lineNum, const Value &right);
+Value indexValue(int lineNum, const Value &v, const Value &i);
+Value assignIndex(int lineNum, const Value &indexable, const Value &i, const Value &value);
+Value addIterationSums(int lineNum, const Value *frame, std::vector<double> &totals);
+std::vector<uint32_t> parallelSums(ForNode *forNode);
@@ -1,10 +0,0 @@
-#pragma once
-#include "node.hpp"
-#include "value.hpp"
-#include "evaluator.hpp"
-#include <map>
-#include <iostream>
-#include <algorithm>
-#include <vector>
-
-void execute(ProgramNode *prog, bool outputSymbolTable);
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "interpreter.hpp"
+#include "builtin.hpp"
+#include "evaluator.hpp"
+#include "optimizer.hpp"
+#include "resolver.hpp"
+#include "vm.hpp"
+#include "y.tab.h"
+
+#include <algorithm>
+#include <iostream>
+
+// Generated by flex, each parse gets a scanner of its own
+int yylex_init_extra(ParseState *state, yyscan_t *scanner);
+void yyset_in(FILE *file, yyscan_t scanner);
+int yylex_destroy(yyscan_t scanner);
+
+Interpreter::Interpreter() : debugger(this) {
+    this->root = NULL;
+    this->frameBase = 0;
+    this->returning = false;
+    this->tailCall = NULL;
+    this->callDepth = 0;
+    this->stackBase = NULL;
+    this->inParallelFor = false;
+
+    Builtin *all[] = {
+        new Random(), new ReadLine(), new Floor(), new Ceil(), new Pi(), new ReadFile(),
+        new Len(), new Sqrt(), new Cos(), new Sin(), new Tan(), new OpenFile(),
+        new NextLine(), new CurrentLine(), new Sum(), new Mean(), new Min(), new Max(),
+        new Dot(), new Scale(), new Elementwise("addlists", addNumbers),
+        new Elementwise("mullists", mulNumbers), new Append(), new Pop(), new Insert(),
+        new Remove(), new Slice(), new Concat()
+    };
+    for (size_t i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        builtins[all[i]->name] = all[i];
+    }
+}
+
+/// Clean up the variables, AST and strings, anything
+/// still live past this point has leaked.
+Interpreter::~Interpreter() {
+    globals.clear();
+    frameStack.clear();
+    arena.release();
+    strings.clear();
+    for (auto it = builtins.begin(); it != builtins.end(); it++) {
+        delete it->second;
+    }
+    if (nodeArena == &arena) {
+        nodeArena = NULL;
+    }
+    if (internPool == &strings) {
+        internPool = NULL;
+    }
+}
+
+/// Allocate nodes and intern strings for this program on
+/// the calling thread.
+void Interpreter::useThread() {
+    nodeArena = &arena;
+    internPool = &strings;
+}
+
+/// Parse a whole source with a scanner of its own, returns
+/// NULL when it has a syntax error.
+ProgramNode *Interpreter::parseSource(FILE *file) {
+    ParseState state;
+    yyscan_t scanner;
+    yylex_init_extra(&state, &scanner);
+    yyset_in(file, scanner);
+    int status = yyparse(&state, scanner);
+    yylex_destroy(scanner);
+    if (status != 0) {
+        return NULL;
+    }
+    return dynamic_cast<ProgramNode*>(state.root);
+}
+
+/// Parse the program read from file, syntax errors are written
+/// to stderr. Returns whether it parsed.
+bool Interpreter::parse(FILE *file) {
+    useThread();
+    root = parseSource(file);
+    return root != NULL;
+}
+
+/// Fold constants in the parsed program and resolve its variables
+/// and calls. Unknown builtins and wrong argument counts are
+/// returned as an error before anything runs.
+Value Interpreter::prepare() {
+    useThread();
+    optimize(root, builtins);
+    return resolve(this, root);
+}
+
+/// Parse a breakpoint condition on its own by wrapping it in an
+/// assignment, returns NULL when it is not a valid expression.
+Node *Interpreter::parseCondition(const std::string &condition) {
+    std::string source = "c = " + condition + "\n";
+    FILE *file = fmemopen((void*)source.c_str(), source.size(), "r");
+    if (file == NULL) {
+        return NULL;
+    }
+    ProgramNode *conditionProgram = parseSource(file);
+    fclose(file);
+    if (conditionProgram == NULL) {
+        return NULL;
+    }
+    NodeList *stmts = conditionProgram->getStmts();
+    if (stmts->size() != 1 || (*stmts)[0]->type != NODE_VAR_ASSIGN) {
+        return NULL;
+    }
+    return dynamic_cast<VarAssignNode*>((*stmts)[0])->value;
+}
+
+/// Register the breakpoints, conditions are parsed and resolved
+/// against the program's variables.
+bool Interpreter::setupBreakpoints() {
+    for (size_t i = 0; i < breakpoints.size(); i++) {
+        Node *condition = NULL;
+        if (!breakpoints[i].second.empty()) {
+            condition = parseCondition(breakpoints[i].second);
+            if (condition == NULL) {
+                std::cout << "ERROR: INVALID BREAKPOINT CONDITION " << breakpoints[i].second << std::endl;
+                return false;
+            }
+            Value error = resolveExpr(this, condition);
+            if (!error.isNull()) {
+                std::cout << error.stringify() << std::endl;
+                return false;
+            }
+        }
+        debugger.addBreakpoint(breakpoints[i].first, condition);
+    }
+    debugger.start(runDebug);
+    return true;
+}
+
+/// Run the prepared program, either on the bytecode VM or by
+/// walking the tree directly. An error is written to stdout
+/// like the symbol table and profile, and is also returned.
+Value Interpreter::run() {
+    useThread();
+    if (!setupBreakpoints()) {
+        return Value::null();
+    }
+    if (runProfile) {
+        profiler.start();
+    }
+    Value v = treeWalk ? ev(root) : runBytecode(this);
+    if (isError(v)) {
+        std::cout << v.stringify() << std::endl;
+    }
+    if (outputSymbolTable) {
+        writeSymbolTable();
+    }
+    if (runProfile) {
+        profiler.write(sourcePath.c_str());
+    }
+    return v;
+}
+
+/// Helper to print the symbol table to stdout, variables
+/// are listed in name order.
+void Interpreter::writeSymbolTable() {
+    std::vector<size_t> order;
+    for (size_t i = 0; i < globals.size(); i++) {
+        if (!globals[i].isNull()) {
+            order.push_back(i);
+        }
+    }
+    std::sort(order.begin(), order.end(), [this](size_t l, size_t r) {
+        return globalNames[l] < globalNames[r];
+    });
+
+    std::cout << "-- Symbol Table Start --" << std::endl;
+    for (size_t i = 0; i < order.size(); i++) {
+        std::cout << globalNames[order[i]] << ": " << globals[order[i]].stringify() << std::endl;
+    }
+    std::cout << "-- Symbol Table End --" << std::endl;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdio>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "arena.hpp"
+#include "node.hpp"
+#include "value.hpp"
+#include "debugger.hpp"
+#include "profiler.hpp"
+
+class Builtin;
+
+/// A Small Basic program and everything it runs with: its syntax
+/// tree and strings, variables, Subs, builtins and options, plus
+/// the tree walker's call stack. Interpreters share none of it, so
+/// separate ones may parse and run programs on separate threads.
+class Interpreter {
+public:
+    // Options, set before the program is run
+    bool runDebug = false;          // Pause after the first statement
+    bool outputSymbolTable = false; // Output the symbol table after running
+    bool treeWalk = false;          // Walk the tree instead of running bytecode
+    bool runProfile = false;        // Collect a profile
+    int maxCallDepth = 10000;       // Deepest nesting of Sub calls before erroring
+    int numThreads = 0;             // Threads a Parallel For runs on, 0 for one per core
+    std::string sourcePath;         // Where the program was read from, for the profile
+    std::vector<std::pair<int, std::string>> breakpoints; // Line and optional condition
+
+    ProgramNode *root;
+    // Global variables live in a flat array indexed by the slot the
+    // resolver gave their identifier. A NULL entry is a variable
+    // that has not been assigned yet.
+    std::vector<Value> globals;
+    std::vector<std::string> globalNames;            // Slot to name table
+    std::unordered_map<const char*, int> slots;      // Global slot by interned ident
+    std::unordered_map<const char*, SubNode*> subs;  // Every Sub by name
+    std::map<std::string, Builtin*> builtins;        // Small Basic standard lib
+    Debugger debugger;
+    Profiler profiler;
+
+    Interpreter();
+    ~Interpreter();
+
+    bool parse(FILE *file);
+    Value prepare();
+    Value run();
+    Value ev(Node *node);
+    void writeSymbolTable();
+
+    // Parallel For helpers shared with the bytecode VM
+    Value prepareParallelFor(int lineNum, const Value &start, const Value &limit, const Value &step,
+                             const std::vector<uint32_t> &sums, size_t &count);
+    void finishParallelFor(const std::vector<uint32_t> &sums, const std::vector<double> &totals);
+    void shareGlobals(bool shared);
+
+private:
+    Arena arena;         // Every node of the program
+    InternPool strings;  // Identifiers and string literals
+
+    // Call stack shared by every Sub call, the frame of the running
+    // Sub starts at frameBase. Builtin arguments are pushed here too.
+    std::vector<Value> frameStack;
+    size_t frameBase;
+    bool returning;      // Set by Return until its Sub call unwinds
+    SubNode *tailCall;   // Sub a Return handed the current frame to
+    int callDepth;
+    char *stackBase;     // Native stack at the outermost Sub call
+    bool inParallelFor;  // Running the body of a Parallel For
+    std::vector<BinaryOpNode*> chainStack; // Operators of the binary chains being evaluated
+
+    void useThread();
+    ProgramNode *parseSource(FILE *file);
+    Node *parseCondition(const std::string &condition);
+    bool setupBreakpoints();
+
+    /// Storage of a resolved variable, a global or a local
+    /// in the frame of the running Sub. Only valid until the
+    /// next call as the frame stack may grow.
+    inline Value &variable(IdentifierNode *ident) {
+        return ident->local ? frameStack[frameBase + ident->slot] : globals[ident->slot];
+    }
+
+    Value evProgram(ProgramNode *program);
+    Value evPrint(PrintNode *print);
+    Value evBinaryOp(BinaryOpNode *binaryOp);
+    Value evUnaryOp(UnaryOpNode *unaryOp);
+    Value evVarAssign(VarAssignNode *varAssign);
+    Value evIdentifier(IdentifierNode *identifier);
+    Value evIf(IfNode *ifNode);
+    Value evBlock(BlockNode *block);
+    Value evWhile(WhileNode *whileNode);
+    Value evFor(ForNode *forNode);
+    Value evParallelFor(ForNode *forNode);
+    Value evSub(SubNode *subNode);
+    Value callSub(SubNode *sub, size_t base, int lineNum);
+    Value evCall(CallNode *callNode);
+    Value evExprList(ExprListNode *listNode);
+    Value evMap(MapNode *map);
+    Value evIndex(IndexNode *idx);
+    Value evIndexAssign(IndexAssignNode *idx);
+    Value evExprNode(ExprNode *e);
+    Value evVarDecl(VarDeclNode *varDecl);
+    Value evReturn(ReturnNode *ret);
+    Value evTailCall(CallNode *callNode);
+};
@@ -0,0 +1,397 @@
+#include "kernels.hpp"
+
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KERNELS_X86
+#include <immintrin.h>
+#define AVX_TARGET __attribute__((target("avx")))
+#define SSE2_TARGET __attribute__((target("sse2")))
+#endif
+
+/// One implementation of every kernel.
+struct Kernels {
+    double (*sum)(const double*, size_t);
+    double (*min)(const double*, size_t);
+    double (*max)(const double*, size_t);
+    double (*dot)(const double*, const double*, size_t);
+    void (*scale)(const double*, double, double*, size_t);
+    void (*add)(const double*, const double*, double*, size_t);
+    void (*mul)(const double*, const double*, double*, size_t);
+};
+
+// Results are stored straight into list elements, where any NaN
+// but the positive quiet one would read back as a boxed Value.
+// The kernels writing numbers replace every NaN with it, as
+// Value::number does.
+static const double canonicalNaN = std::numeric_limits<double>::quiet_NaN();
+
+static inline double canonical(double x) {
+    return x != x ? canonicalNaN : x;
+}
+
+/// The smaller of two numbers, NaN when either is. std::min would
+/// keep a when b is NaN but not the other way round.
+static inline double minOf(double a, double b) {
+    return b < a || b != b ? b : a;
+}
+
+/// The larger of two numbers, NaN when either is.
+static inline double maxOf(double a, double b) {
+    return b > a || b != b ? b : a;
+}
+
+/// Replace the NaNs in n results, run by the vector loops only
+/// once they have seen one.
+static void canonicalize(double *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = canonical(out[i]);
+    }
+}
+
+// Plain loops, used when no vector instructions are available
+// and for the elements left over after the vector loops. min and
+// max return NaN when any element is NaN, on every path.
+
+static double scalarSum(const double *v, size_t n) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += v[i];
+    }
+    return total;
+}
+
+static double scalarMin(const double *v, size_t n) {
+    double m = v[0];
+    for (size_t i = 1; i < n; i++) {
+        m = minOf(m, v[i]);
+    }
+    return canonical(m);
+}
+
+static double scalarMax(const double *v, size_t n) {
+    double m = v[0];
+    for (size_t i = 1; i < n; i++) {
+        m = maxOf(m, v[i]);
+    }
+    return canonical(m);
+}
+
+static double scalarDot(const double *a, const double *b, size_t n) {
+    double total = 0;
+    for (size_t i = 0; i < n; i++) {
+        total += a[i] * b[i];
+    }
+    return total;
+}
+
+static void scalarScale(const double *v, double k, double *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = canonical(v[i] * k);
+    }
+}
+
+static void scalarAdd(const double *a, const double *b, double *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = canonical(a[i] + b[i]);
+    }
+}
+
+static void scalarMul(const double *a, const double *b, double *out, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        out[i] = canonical(a[i] * b[i]);
+    }
+}
+
+static const Kernels scalarKernels = {
+    scalarSum, scalarMin, scalarMax, scalarDot, scalarScale, scalarAdd, scalarMul
+};
+
+#ifdef KERNELS_X86
+
+// SSE2, two doubles per register.
+
+SSE2_TARGET static double sseHorizontalAdd(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+SSE2_TARGET static double sseSum(const double *v, size_t n) {
+    __m128d a = _mm_setzero_pd();
+    __m128d b = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        a = _mm_add_pd(a, _mm_loadu_pd(v + i));
+        b = _mm_add_pd(b, _mm_loadu_pd(v + i + 2));
+    }
+    return sseHorizontalAdd(_mm_add_pd(a, b)) + scalarSum(v + i, n - i);
+}
+
+SSE2_TARGET static double sseMin(const double *v, size_t n) {
+    if (n < 2) {
+        return scalarMin(v, n);
+    }
+    // _mm_min_pd returns its second operand when either is NaN,
+    // so NaNs are looked for separately
+    __m128d m = _mm_loadu_pd(v);
+    __m128d nans = _mm_cmpunord_pd(m, m);
+    size_t i = 2;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(v + i);
+        nans = _mm_or_pd(nans, _mm_cmpunord_pd(x, x));
+        m = _mm_min_pd(m, x);
+    }
+    if (_mm_movemask_pd(nans)) {
+        return canonicalNaN;
+    }
+    m = _mm_min_sd(m, _mm_unpackhi_pd(m, m));
+    double result = _mm_cvtsd_f64(m);
+    return i < n ? canonical(minOf(result, v[i])) : result;
+}
+
+SSE2_TARGET static double sseMax(const double *v, size_t n) {
+    if (n < 2) {
+        return scalarMax(v, n);
+    }
+    // _mm_max_pd returns its second operand when either is NaN,
+    // so NaNs are looked for separately
+    __m128d m = _mm_loadu_pd(v);
+    __m128d nans = _mm_cmpunord_pd(m, m);
+    size_t i = 2;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(v + i);
+        nans = _mm_or_pd(nans, _mm_cmpunord_pd(x, x));
+        m = _mm_max_pd(m, x);
+    }
+    if (_mm_movemask_pd(nans)) {
+        return canonicalNaN;
+    }
+    m = _mm_max_sd(m, _mm_unpackhi_pd(m, m));
+    double result = _mm_cvtsd_f64(m);
+    return i < n ? canonical(maxOf(result, v[i])) : result;
+}
+
+SSE2_TARGET static double sseDot(const double *a, const double *b, size_t n) {
+    __m128d total = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        total = _mm_add_pd(total, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    }
+    return sseHorizontalAdd(total) + scalarDot(a + i, b + i, n - i);
+}
+
+SSE2_TARGET static void sseScale(const double *v, double k, double *out, size_t n) {
+    __m128d factor = _mm_set1_pd(k);
+    __m128d nans = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d r = _mm_mul_pd(_mm_loadu_pd(v + i), factor);
+        nans = _mm_or_pd(nans, _mm_cmpunord_pd(r, r));
+        _mm_storeu_pd(out + i, r);
+    }
+    if (_mm_movemask_pd(nans)) {
+        canonicalize(out, i);
+    }
+    scalarScale(v + i, k, out + i, n - i);
+}
+
+SSE2_TARGET static void sseAdd(const double *a, const double *b, double *out, size_t n) {
+    __m128d nans = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d r = _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+        nans = _mm_or_pd(nans, _mm_cmpunord_pd(r, r));
+        _mm_storeu_pd(out + i, r);
+    }
+    if (_mm_movemask_pd(nans)) {
+        canonicalize(out, i);
+    }
+    scalarAdd(a + i, b + i, out + i, n - i);
+}
+
+SSE2_TARGET static void sseMul(const double *a, const double *b, double *out, size_t n) {
+    __m128d nans = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d r = _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i));
+        nans = _mm_or_pd(nans, _mm_cmpunord_pd(r, r));
+        _mm_storeu_pd(out + i, r);
+    }
+    if (_mm_movemask_pd(nans)) {
+        canonicalize(out, i);
+    }
+    scalarMul(a + i, b + i, out + i, n - i);
+}
+
+static const Kernels sseKernels = {
+    sseSum, sseMin, sseMax, sseDot, sseScale, sseAdd, sseMul
+};
+
+// AVX, four doubles per register.
+
+AVX_TARGET static double avxHorizontalAdd(__m256d v) {
+    __m128d lo = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+AVX_TARGET static double avxSum(const double *v, size_t n) {
+    __m256d a = _mm256_setzero_pd();
+    __m256d b = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        a = _mm256_add_pd(a, _mm256_loadu_pd(v + i));
+        b = _mm256_add_pd(b, _mm256_loadu_pd(v + i + 4));
+    }
+    return avxHorizontalAdd(_mm256_add_pd(a, b)) + scalarSum(v + i, n - i);
+}
+
+AVX_TARGET static double avxMin(const double *v, size_t n) {
+    if (n < 4) {
+        return scalarMin(v, n);
+    }
+    // As in sseMin, NaNs are looked for separately
+    __m256d m = _mm256_loadu_pd(v);
+    __m256d nans = _mm256_cmp_pd(m, m, _CMP_UNORD_Q);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(v + i);
+        nans = _mm256_or_pd(nans, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+        m = _mm256_min_pd(m, x);
+    }
+    if (_mm256_movemask_pd(nans)) {
+        return canonicalNaN;
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double result = scalarMin(lanes, 4);
+    return i < n ? minOf(result, scalarMin(v + i, n - i)) : result;
+}
+
+AVX_TARGET static double avxMax(const double *v, size_t n) {
+    if (n < 4) {
+        return scalarMax(v, n);
+    }
+    // As in sseMax, NaNs are looked for separately
+    __m256d m = _mm256_loadu_pd(v);
+    __m256d nans = _mm256_cmp_pd(m, m, _CMP_UNORD_Q);
+    size_t i = 4;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(v + i);
+        nans = _mm256_or_pd(nans, _mm256_cmp_pd(x, x, _CMP_UNORD_Q));
+        m = _mm256_max_pd(m, x);
+    }
+    if (_mm256_movemask_pd(nans)) {
+        return canonicalNaN;
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, m);
+    double result = scalarMax(lanes, 4);
+    return i < n ? maxOf(result, scalarMax(v + i, n - i)) : result;
+}
+
+AVX_TARGET static double avxDot(const double *a, const double *b, size_t n) {
+    __m256d total = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        total = _mm256_add_pd(total, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    }
+    return avxHorizontalAdd(total) + scalarDot(a + i, b + i, n - i);
+}
+
+AVX_TARGET static void avxScale(const double *v, double k, double *out, size_t n) {
+    __m256d factor = _mm256_set1_pd(k);
+    __m256d nans = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d r = _mm256_mul_pd(_mm256_loadu_pd(v + i), factor);
+        nans = _mm256_or_pd(nans, _mm256_cmp_pd(r, r, _CMP_UNORD_Q));
+        _mm256_storeu_pd(out + i, r);
+    }
+    if (_mm256_movemask_pd(nans)) {
+        canonicalize(out, i);
+    }
+    scalarScale(v + i, k, out + i, n - i);
+}
+
+AVX_TARGET static void avxAdd(const double *a, const double *b, double *out, size_t n) {
+    __m256d nans = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d r = _mm256_add_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+        nans = _mm256_or_pd(nans, _mm256_cmp_pd(r, r, _CMP_UNORD_Q));
+        _mm256_storeu_pd(out + i, r);
+    }
+    if (_mm256_movemask_pd(nans)) {
+        canonicalize(out, i);
+    }
+    scalarAdd(a + i, b + i, out + i, n - i);
+}
+
+AVX_TARGET static void avxMul(const double *a, const double *b, double *out, size_t n) {
+    __m256d nans = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d r = _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+        nans = _mm256_or_pd(nans, _mm256_cmp_pd(r, r, _CMP_UNORD_Q));
+        _mm256_storeu_pd(out + i, r);
+    }
+    if (_mm256_movemask_pd(nans)) {
+        canonicalize(out, i);
+    }
+    scalarMul(a + i, b + i, out + i, n - i);
+}
+
+static const Kernels avxKernels = {
+    avxSum, avxMin, avxMax, avxDot, avxScale, avxAdd, avxMul
+};
+
+#endif
+
+/// The best kernels for this CPU.
+static const Kernels &chooseKernels() {
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx")) {
+        return avxKernels;
+    } else if (__builtin_cpu_supports("sse2")) {
+        return sseKernels;
+    }
+#endif
+    return scalarKernels;
+}
+
+/// The best kernels for this CPU, chosen on first use. The
+/// choice is made once even when several threads get here.
+static const Kernels &kernels() {
+    static const Kernels &chosen = chooseKernels();
+    return chosen;
+}
+
+double sumNumbers(const double *values, size_t count) {
+    return kernels().sum(values, count);
+}
+
+/// Smallest of count numbers, count must not be 0.
+double minNumbers(const double *values, size_t count) {
+    return kernels().min(values, count);
+}
+
+/// Largest of count numbers, count must not be 0.
+double maxNumbers(const double *values, size_t count) {
+    return kernels().max(values, count);
+}
+
+double dotNumbers(const double *left, const double *right, size_t count) {
+    return kernels().dot(left, right, count);
+}
+
+void scaleNumbers(const double *values, double factor, double *out, size_t count) {
+    kernels().scale(values, factor, out, count);
+}
+
+void addNumbers(const double *left, const double *right, double *out, size_t count) {
+    kernels().add(left, right, out, count);
+}
+
+void mulNumbers(const double *left, const double *right, double *out, size_t count) {
+    kernels().mul(left, right, out, count);
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+
+// Numeric kernels over contiguous doubles used by the bulk list
+// builtins. The first call picks AVX, SSE2 or plain loops for
+// whatever the CPU supports. Sums add in several lanes at once so
+// may round differently from adding the elements in order.
+double sumNumbers(const double *values, size_t count);
+double minNumbers(const double *values, size_t count);
+double maxNumbers(const double *values, size_t count);
+double dotNumbers(const double *left, const double *right, size_t count);
+void scaleNumbers(const double *values, double factor, double *out, size_t count);
+void addNumbers(const double *left, const double *right, double *out, size_t count);
+void mulNumbers(const double *left, const double *right, double *out, size_t count);
@@ -1,30 +1,31 @@
-#include "execute.hpp"
+#include "interpreter.hpp"
+#include "optimizer.hpp"
+#include "output.hpp"
 #include <iostream>
-#include <random>
-#include <vector>
 #include <time.h>
 #include <string.h>
-#include <map>
 
-extern int yyparse();
-extern FILE *yyin;
 char *inputFileName;
-bool runDebug = false;
-bool outputSymbolTable = false;
-std::vector<int> breakpoints;
+bool outputGCStats = false;
+bool dumpAst = false;
 
-Node *root;
-std::map<std::string, Value*> env;
-
-/// Call interpeter in format ./sb input.sb --debug --sym
-void parseArguments(int argc, char *argv[]) {
+/// Call interpeter in format ./sb input.sb --debug --sym --tree --gc-stats --profile --dump-ast --max-depth 10000 --threads 8
+void parseArguments(int argc, char *argv[], Interpreter &interp) {
     if (argc < 2) {
         std::cout << "ERROR: NO INPUT FILE PROVIDED" << std::endl;
-        std::cout << "Usage: ./sb inputFile [--debug] [--sym] [breakpoints]" << std::endl;
-        std::cout << "    --debug                : Run program statement by statement" << std::endl;
+        std::cout << "Usage: ./sb inputFile [--debug] [--sym] [--tree] [--gc-stats] [--profile] [--dump-ast] [--max-depth N] [--threads N] [breakpoints]" << std::endl;
+        std::cout << "    --debug                : Run program statement by statement, next steps over Subs," << std::endl;
+        std::cout << "                             step steps into them, continue runs to the next breakpoint" << std::endl;
         std::cout << "    --sym                  : Output symbol table after execution" << std::endl;
+        std::cout << "    --tree                 : Run with the tree walking evaluator instead of the VM" << std::endl;
+        std::cout << "    --gc-stats             : Output heap allocation counts after execution" << std::endl;
+        std::cout << "    --profile              : Output per line and per sub timings, writes inputFile.folded" << std::endl;
+        std::cout << "    --dump-ast             : Output the optimised syntax tree instead of running" << std::endl;
+        std::cout << "    --max-depth N          : Error when Sub calls nest deeper than N, defaults to 10000" << std::endl;
+        std::cout << "    --threads N            : Run Parallel For iterations on N threads, defaults to one per core" << std::endl;
         std::cout << "    breakpoints            : A list of line numbers to place breakpoints at for example:" << std::endl;
         std::cout << "                             1 5 17 would place breakpoints at line 1, 5 and 17 respectively" << std::endl;
+        std::cout << "                             \"12:i == 5\" would only pause at line 12 when i == 5 holds" << std::endl;
         inputFileName = NULL;
         return;
     }
@@ -33,13 +34,26 @@ void parseArguments(int argc, char *argv[]) {
         for (int i = 2; i < argc; i++) {
             char *arg = argv[i];
             if (strcmp(arg, "--debug") == 0) {
-                runDebug = true;
+                interp.runDebug = true;
             } else if (strcmp(arg, "--sym") == 0) {
-                outputSymbolTable = true;
+                interp.outputSymbolTable = true;
+            } else if (strcmp(arg, "--tree") == 0) {
+                interp.treeWalk = true;
+            } else if (strcmp(arg, "--gc-stats") == 0) {
+                outputGCStats = true;
+            } else if (strcmp(arg, "--profile") == 0) {
+                interp.runProfile = true;
+            } else if (strcmp(arg, "--dump-ast") == 0) {
+                dumpAst = true;
+            } else if (strcmp(arg, "--max-depth") == 0 && i + 1 < argc) {
+                interp.maxCallDepth = atoi(argv[++i]);
+            } else if (strcmp(arg, "--threads") == 0 && i + 1 < argc) {
+                interp.numThreads = atoi(argv[++i]);
             } else {
                 int lineNum = (int) atoi(arg);
                 if (lineNum > 0) {
-                    breakpoints.push_back(lineNum);
+                    const char *condition = strchr(arg, ':');
+                    interp.breakpoints.push_back({lineNum, condition == NULL ? "" : condition + 1});
                 }
             }
         }
@@ -49,26 +63,40 @@ void parseArguments(int argc, char *argv[]) {
 
 /// Main entrypoint
 int main(int argc, char *argv[]) {
-    parseArguments(argc, argv);
+    initOutput();
+    Interpreter *interp = new Interpreter();
+    parseArguments(argc, argv, *interp);
     if (inputFileName == NULL) {
+        delete interp;
         return 1;
     }
 
-    yyin = fopen(inputFileName, "r");
-    if (yyin == NULL) {
+    FILE *file = fopen(inputFileName, "r");
+    if (file == NULL) {
         std::cout << "ERROR: INPUT FILE COULD NOT BE FOUND!" << std::endl;
+        delete interp;
         return 1;
     }
 
     srand(time(NULL));
-    registerBuiltins();
-    int status = yyparse();
-    if (status == 0) {
-        // Successful parse
-        ProgramNode *prog = dynamic_cast<ProgramNode*>(root);
-        execute(prog, outputSymbolTable);
+    interp->sourcePath = inputFileName;
+    bool parsed = interp->parse(file);
+    fclose(file);
+    if (parsed) {
+        Value error = interp->prepare();
+        if (!error.isNull()) {
+            std::cout << error.stringify() << std::endl;
+        } else if (dumpAst) {
+            writeAst(interp->root);
+        } else {
+            interp->run();
+        }
     }
-    // Clean up the AST after we are done
-    delete root;
+    // Anything still live once the interpreter is gone has leaked
+    delete interp;
+    if (outputGCStats) {
+        writeGCStats(std::cout);
+    }
+    flushOutput();
     return 0;
-}
\ No newline at end of file
+}
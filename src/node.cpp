@@ -1 +1,3 @@
-#include "node.hpp"
\ No newline at end of file
+#include "node.hpp"
+
+thread_local Arena *nodeArena = NULL;
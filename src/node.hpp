@@ -7,6 +7,7 @@
 #include <cstring>
 
 #include "value.hpp"
+#include "arena.hpp"
 
 /// Enum containing every distinct node type
 /// contained in the abstract node class
@@ -33,28 +34,44 @@ enum NodeType {
     NODE_MAP,
     NODE_INDEX_ASSIGN,
     NODE_INDEX,
-    NODE_BUILTIN,
-    NODE_EXPR
+    NODE_EXPR,
+    NODE_RETURN
 };
 
+class Node;
+class Builtin;
+class SubNode;
+
+// Arena every node is allocated from, each Interpreter points it
+// at its own on the thread parsing its program
+extern thread_local Arena *nodeArena;
+
+/// List of child nodes, stored in the node arena.
+typedef std::vector<Node*, ArenaAllocator<Node*>> NodeList;
+
 /// Abstract node class containg information needed for all nodes.
+/// Nodes are allocated from nodeArena and freed together when it is
+/// released, destructors only run for nodes that register a cleanup.
 class Node {
 public:
     NodeType type; // The type of node.
-    char *token;   // Debug string helper to help identify nodes when printing.
-    int lineNum;   // What line this node is on.
+    const char *token; // Debug string helper to help identify nodes when printing, always a literal.
+    int lineNum;       // What line this node is on.
 
     Node(NodeType type, const char *token, int lineNum) {
         this->type = type;
-        this->token = (char *)malloc(strlen(token) + 1);
-        strcpy(this->token, token);
+        this->token = token;
         this->lineNum = lineNum;
     }
 
-    virtual ~Node() {
-        free(token);
+    virtual ~Node() {}
+
+    static void *operator new(size_t size) {
+        return nodeArena->allocate(size);
     }
 
+    static void operator delete(void *) {}
+
     virtual void f() {}
 };
 
@@ -62,37 +79,27 @@ public:
 /// statements in order.
 class ProgramNode : public Node {
 public:
-    ProgramNode(const char *token) : Node(NODE_PROGRAM, token, 0) {
+    ProgramNode(const char *token) : Node(NODE_PROGRAM, token, 0), stmts(nodeArena) {
     }
 
     void addNode(Node *node) { 
         stmts.push_back(node);
     }
 
-    std::vector<Node*> *getStmts() { return &stmts; }
+    NodeList *getStmts() { return &stmts; }
 
-    virtual ~ProgramNode() {
-        for (int i = 0; i < stmts.size(); i++) {
-            Node *stmt = stmts[i];
-            delete stmt;
-        }
-    }
 private:
-    std::vector<Node*> stmts;
+    NodeList stmts;
 };
 
 /// Node representing a number value,
 /// simply contains the corresponding number value.
 class NumberNode : public Node {
 public:
-    NumberValue *value;
+    Value value;
 
     NumberNode(double value, const char *token, int lineNum) : Node(NODE_NUMBER, token, lineNum) {
-        this->value = new NumberValue(value);
-    }
-
-    virtual ~NumberNode() {
-        delete value;
+        this->value = Value::number(value);
     }
 };
 
@@ -100,14 +107,10 @@ public:
 /// simply contains the corresponding bool value.
 class BooleanNode : public Node {
 public:
-    BoolValue *value;
+    Value value;
 
     BooleanNode(bool value, const char *token, int lineNum) : Node(NODE_BOOLEAN, token, lineNum) {
-        this->value = new BoolValue(value);
-    }
-
-    virtual ~BooleanNode() {
-        delete value;
+        this->value = Value::boolean(value);
     }
 };
 
@@ -115,14 +118,23 @@ public:
 /// simply contains the corresponding string value.
 class StringNode : public Node {
 public:
-    StringValue *value;
+    Value value;
+
+    StringNode(const char *value, const char *token, int lineNum) : Node(NODE_STRING, token, lineNum) {
+        this->value = internString(value, strlen(value));
+        nodeArena->addCleanup(destroy, this);
+    }
 
-    StringNode(char *value, const char *token, int lineNum) : Node(NODE_STRING, token, lineNum) {
-        this->value = new StringValue(value);
+    /// Build a literal from an already computed string value.
+    StringNode(Value value, const char *token, int lineNum) : Node(NODE_STRING, token, lineNum) {
+        StringRef ref(value);
+        this->value = internString(ref.data(), ref.size());
+        nodeArena->addCleanup(destroy, this);
     }
 
-    virtual ~StringNode() {
-        delete value;
+    /// Drop the reference to the literal when the arena is released.
+    static void destroy(void *node) {
+        ((StringNode *)node)->~StringNode();
     }
 };
 
@@ -130,15 +142,14 @@ public:
 /// contains the raw char* ident.
 class IdentifierNode : public Node {
 public:
-    char *ident;
+    const char *ident; // Interned, compare by pointer
+    int slot;          // Index into the globals or the Sub's frame, set by the resolver
+    bool local;        // Slot is in the current Sub's frame
 
-    IdentifierNode(char *ident, const char *token, int lineNum) : Node(NODE_IDENTIFIER, token, lineNum) {
-        this->ident = (char *)malloc(strlen(ident) + 1);
-        strcpy(this->ident, ident);
-    }
-
-    virtual ~IdentifierNode() {
-        free(ident);
+    IdentifierNode(const char *ident, const char *token, int lineNum) : Node(NODE_IDENTIFIER, token, lineNum) {
+        this->ident = intern(ident, strlen(ident))->chars();
+        this->slot = -1;
+        this->local = false;
     }
 };
 
@@ -151,10 +162,6 @@ public:
     PrintNode(Node *exp, const char *token, int lineNum) : Node(NODE_PRINT, token, lineNum) {
         this->exp = exp;
     }
-
-    virtual ~PrintNode() {
-        delete exp;
-    }
 };
 
 /// Node for a binary operation.
@@ -170,11 +177,6 @@ public:
         this->left = left;
         this->right = right;
     }
-
-    virtual ~BinaryOpNode() {
-        delete left;
-        delete right;
-    }
 };
 
 /// Node for a unary operation.
@@ -188,15 +190,12 @@ public:
         this->op = op;
         this->right = right;
     }
-
-    virtual ~UnaryOpNode() {
-        delete right;
-    }
 };
 
 /// Node for a var declaration, contains the
-/// identifier node and the value node.
-/// ident = value
+/// identifier node and the value node. Inside
+/// a Sub it declares a local variable.
+/// Var ident = value
 class VarDeclNode : public Node {
 public:
     Node *ident;
@@ -206,11 +205,6 @@ public:
         this->ident = ident;
         this->value = value;
     }
-
-    virtual ~VarDeclNode() {
-        delete ident;
-        delete value;
-    }
 };
 
 /// Node for a var assignment contains the
@@ -225,34 +219,22 @@ public:
         this->ident = ident;
         this->value = value;
     }
-
-    virtual ~VarAssignNode() {
-        delete ident;
-        delete value;
-    }
 };
 
 /// Node for a block of statements.
 /// Contains a list of other nodes within the block.
 class BlockNode : public Node {
 public:
-    BlockNode(const char *token, int lineNum) : Node(NODE_BLOCK, token, lineNum) {}
+    BlockNode(const char *token, int lineNum) : Node(NODE_BLOCK, token, lineNum), stmts(nodeArena) {}
 
     void addNode(Node *node) { 
         stmts.push_back(node);
     }
 
-    std::vector<Node*> *getStmts() { return &stmts; }
-
-    virtual ~BlockNode() {
-        for (int i = 0; i < stmts.size(); i++) {
-            Node *stmt = stmts[i];
-            delete stmt;
-        }
-    }
+    NodeList *getStmts() { return &stmts; }
 
 private:
-    std::vector<Node*> stmts;
+    NodeList stmts;
 };
 
 /// Node for an if statement.
@@ -270,12 +252,6 @@ public:
         this->thenBranch = thenBranch;
         this->elseBranch = elseBranch;
     }
-
-    virtual ~IfNode() {
-        delete expr;
-        delete thenBranch;
-        delete elseBranch;
-    }
 };
 
 /// Node for a while statement.
@@ -290,11 +266,6 @@ public:
         this->expr = expr;
         this->block = block;
     }
-
-    virtual ~WhileNode() {
-        delete expr;
-        delete block;
-    }
 };
 
 /// Node for a for statement.
@@ -302,6 +273,7 @@ public:
 /// the start value, the max value (stop condition),
 /// the step (increment) and the block to be executed.
 /// For Let ident = value To max Step step Do block
+/// A Parallel For adds Parallel Sum a, b before Do.
 class ForNode : public Node {
 public:
     Node *ident;
@@ -309,6 +281,9 @@ public:
     Node *max;
     Node *step;
     Node *block;
+    bool parallel;  // Iterations may run on several threads
+    Node *sums;     // ExprListNode of the variables a Parallel For sums into, or NULL
+    SubNode *body;  // Parallel body run once per iteration, set by the resolver
 
     ForNode(Node *ident, Node *value, Node *max, Node *step, Node *block, const char *token, int lineNum) : Node(NODE_FOR, token, lineNum) {
         this->ident = ident;
@@ -316,49 +291,62 @@ public:
         this->max = max;
         this->step = step;
         this->block = block;
+        this->parallel = false;
+        this->sums = NULL;
+        this->body = NULL;
     }
 
-    virtual ~ForNode() {
-        delete ident;
-        delete value;
-        delete max;
-        delete step;
-        delete block;
+    void makeParallel(Node *sums) {
+        this->parallel = true;
+        this->sums = sums;
     }
-
 };
 
 /// Node for subroutine definition.
-/// Contains the subroutine's ident
+/// Contains the subroutine's ident, its parameters
 /// and the block to be executed when called.
+/// Parameters and Var declarations are the Sub's
+/// locals, numLocals is set by the resolver.
 class SubNode : public Node {
 public:
     Node *ident;
+    Node *params; // ExprListNode of IdentifierNodes
     Node *block;
+    int numLocals;
 
-    SubNode(Node *ident, Node *block, const char *token, int lineNum) : Node(NODE_SUB, token, lineNum) {
+    SubNode(Node *ident, Node *params, Node *block, const char *token, int lineNum) : Node(NODE_SUB, token, lineNum) {
         this->ident = ident;
+        this->params = params;
         this->block = block;
-    }
-
-    virtual ~SubNode() {
-        delete ident;
-        delete block;
+        this->numLocals = 0;
     }
 };
 
-/// Node for a subroutine call
-/// Stores the ident of the sub called.
+/// Node for a call, ident(args), to either a Sub or
+/// a builtin. The resolver binds it to one of them.
 class CallNode : public Node {
 public:
     Node *ident;
+    Node *args;       // ExprListNode
+    SubNode *sub;     // Set when calling a Sub
+    Builtin *builtin; // Set when calling a builtin
 
-    CallNode(Node *ident, const char *token, int lineNum) : Node(NODE_CALL, token, lineNum) {
+    CallNode(Node *ident, Node *args, const char *token, int lineNum) : Node(NODE_CALL, token, lineNum) {
         this->ident = ident;
+        this->args = args;
+        this->sub = NULL;
+        this->builtin = NULL;
     }
+};
 
-    virtual ~CallNode() {
-        delete ident;
+/// Node for returning from a Sub, the
+/// value is NULL for a plain Return.
+class ReturnNode : public Node {
+public:
+    Node *value;
+
+    ReturnNode(Node *value, const char *token, int lineNum) : Node(NODE_RETURN, token, lineNum) {
+        this->value = value;
     }
 };
 
@@ -366,44 +354,25 @@ public:
 /// Contains a list of other nodes.
 class ExprListNode : public Node {
 public:
-    std::vector<Node*> exprs;
+    NodeList exprs;
 
-    ExprListNode(const char *token, int lineNum) : Node(NODE_EXPR_LIST, token, lineNum) {}
+    ExprListNode(const char *token, int lineNum) : Node(NODE_EXPR_LIST, token, lineNum), exprs(nodeArena) {}
 
     void addNode(Node *expr) {
         exprs.push_back(expr);
     }
-
-    virtual ~ExprListNode() {
-        for (int i = 0; i < exprs.size(); i++) {
-            Node *expr = exprs[i];
-            delete expr;
-        }
-    }
-
 };
 
 /// Node representing a map.
 /// Contains node key value pairs.
 class MapNode : public Node {
 public:
-    std::map<Node*, Node*> exprs;
-    MapNode(const char *token, int lineNum) : Node(NODE_MAP, token, lineNum) {}
+    std::vector<std::pair<Node*, Node*>, ArenaAllocator<std::pair<Node*, Node*>>> exprs; // Key value pairs in source order
+    MapNode(const char *token, int lineNum) : Node(NODE_MAP, token, lineNum), exprs(nodeArena) {}
 
     void addNode(Node *key, Node *val) {
-        exprs[key] = val;
-    }
-
-    virtual ~MapNode() {
-        std::map<Node*, Node*>::iterator it;
-        for (it = exprs.begin(); it != exprs.end(); it++) {
-            Node *key = it->first;
-            Node *value = it->second;
-            delete key;
-            delete value;
-        }
+        exprs.push_back(std::make_pair(key, val));
     }
-
 };
 
 /// Node for index assignment.
@@ -422,13 +391,6 @@ public:
         this->index = index;
         this->value = value;
     }
-
-    virtual ~IndexAssignNode() {
-        delete ident;
-        delete index;
-        delete value;
-    }
-
 };
 
 /// Node for an index retrieval.
@@ -442,31 +404,6 @@ public:
         this->ident = ident;
         this->index = index;
     }
-
-    virtual ~IndexNode() {
-        delete ident;
-        delete index;
-    }
-
-};
-
-/// Node representing a builtin standard library
-/// function call. Contains the identifier for it
-/// and the arguements it is called with.
-class BuiltInNode : public Node {
-public:
-    Node *ident;
-    Node *args;
-
-    BuiltInNode(Node *ident, Node *args, const char *token, int lineNum) : Node(NODE_BUILTIN, token, lineNum) {
-        this->ident = ident;
-        this->args = args;
-    }
-
-    virtual ~BuiltInNode() {
-        delete ident;
-        delete args;
-    }
 };
 
 /// Node representing an expression.
@@ -478,8 +415,4 @@ public:
     ExprNode(Node *expr, const char *token, int lineNum) : Node(NODE_EXPR, token, lineNum) {
         this->expr = expr;
     }
-
-    virtual ~ExprNode() {
-        delete expr;
-    }
 };
@@ -0,0 +1,442 @@
+#include "optimizer.hpp"
+#include "evaluator.hpp"
+#include "builtin.hpp"
+
+/// Rewrites the AST once after parsing. Constant operators and
+/// pure builtin calls on constants become literals, Ifs with a
+/// constant condition are replaced by the branch taken and
+/// statements with no effect are dropped. Anything that would
+/// fail at runtime is left alone so the error is still reported
+/// when, and only if, that code runs.
+class Optimizer {
+public:
+    Optimizer(const std::map<std::string, Builtin*> &builtins) : builtins(builtins) {}
+
+    void optimizeStmts(NodeList *stmts) {
+        NodeList result(nodeArena);
+        for (size_t i = 0; i < stmts->size(); i++) {
+            addStmt(&result, (*stmts)[i]);
+        }
+        stmts->swap(result);
+    }
+
+private:
+    const std::map<std::string, Builtin*> &builtins; // Small Basic standard lib
+
+    /// Optimize a statement and add what is left of it to stmts.
+    void addStmt(NodeList *stmts, Node *node) {
+        if (node == NULL) {
+            return;
+        }
+        switch (node->type) {
+            case NODE_IF: {
+                IfNode *ifNode = dynamic_cast<IfNode*>(node);
+                ifNode->expr = fold(ifNode->expr);
+                if (isConstant(ifNode->expr)) {
+                    Node *taken = isTruthy(constantValue(ifNode->expr)) ? ifNode->thenBranch : ifNode->elseBranch;
+                    addBranch(stmts, taken);
+                    return;
+                }
+                ifNode->thenBranch = optimizeBranch(ifNode->thenBranch);
+                ifNode->elseBranch = optimizeBranch(ifNode->elseBranch);
+                break;
+            }
+            case NODE_WHILE: {
+                WhileNode *whileNode = dynamic_cast<WhileNode*>(node);
+                whileNode->expr = fold(whileNode->expr);
+                if (isConstant(whileNode->expr) && !isTruthy(constantValue(whileNode->expr))) {
+                    return;
+                }
+                optimizeBranch(whileNode->block);
+                break;
+            }
+            case NODE_FOR: {
+                ForNode *forNode = dynamic_cast<ForNode*>(node);
+                forNode->value = fold(forNode->value);
+                forNode->max = fold(forNode->max);
+                forNode->step = fold(forNode->step);
+                optimizeBranch(forNode->block);
+                break;
+            }
+            case NODE_SUB:
+                optimizeBranch(dynamic_cast<SubNode*>(node)->block);
+                break;
+            case NODE_BLOCK:
+                optimizeBranch(node);
+                break;
+            case NODE_PRINT: {
+                PrintNode *print = dynamic_cast<PrintNode*>(node);
+                print->exp = fold(print->exp);
+                break;
+            }
+            case NODE_VAR_ASSIGN: {
+                VarAssignNode *assign = dynamic_cast<VarAssignNode*>(node);
+                assign->value = fold(assign->value);
+                break;
+            }
+            case NODE_VAR_DECL: {
+                VarDeclNode *decl = dynamic_cast<VarDeclNode*>(node);
+                decl->value = fold(decl->value);
+                break;
+            }
+            case NODE_RETURN: {
+                ReturnNode *ret = dynamic_cast<ReturnNode*>(node);
+                ret->value = fold(ret->value);
+                break;
+            }
+            case NODE_INDEX_ASSIGN: {
+                IndexAssignNode *idx = dynamic_cast<IndexAssignNode*>(node);
+                idx->index = fold(idx->index);
+                idx->value = fold(idx->value);
+                break;
+            }
+            case NODE_EXPR: {
+                ExprNode *expr = dynamic_cast<ExprNode*>(node);
+                expr->expr = fold(expr->expr);
+                if (expr->expr == NULL || isConstant(expr->expr)) {
+                    return;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+        stmts->push_back(node);
+    }
+
+    /// Splice the statements of a branch known to be taken.
+    void addBranch(NodeList *stmts, Node *branch) {
+        if (branch == NULL) {
+            return;
+        }
+        if (branch->type != NODE_BLOCK) {
+            addStmt(stmts, branch);
+            return;
+        }
+        NodeList *inner = dynamic_cast<BlockNode*>(branch)->getStmts();
+        for (size_t i = 0; i < inner->size(); i++) {
+            addStmt(stmts, (*inner)[i]);
+        }
+    }
+
+    /// Optimize the body of a compound statement, returns the
+    /// node to use in its place.
+    Node *optimizeBranch(Node *branch) {
+        if (branch == NULL) {
+            return NULL;
+        }
+        if (branch->type == NODE_BLOCK) {
+            optimizeStmts(dynamic_cast<BlockNode*>(branch)->getStmts());
+            return branch;
+        }
+        // An ElseIf chain holds the next If directly, it may fold away
+        BlockNode *block = new BlockNode("BLOCK", branch->lineNum);
+        addStmt(block->getStmts(), branch);
+        NodeList *stmts = block->getStmts();
+        if (stmts->empty()) {
+            return NULL;
+        }
+        if (stmts->size() == 1 && (*stmts)[0] == branch) {
+            return branch;
+        }
+        return block;
+    }
+
+    static bool isConstant(Node *node) {
+        return node != NULL && (node->type == NODE_NUMBER || node->type == NODE_BOOLEAN || node->type == NODE_STRING);
+    }
+
+    static Value constantValue(Node *node) {
+        switch (node->type) {
+            case NODE_NUMBER:
+                return dynamic_cast<NumberNode*>(node)->value;
+            case NODE_BOOLEAN:
+                return dynamic_cast<BooleanNode*>(node)->value;
+            default:
+                return dynamic_cast<StringNode*>(node)->value;
+        }
+    }
+
+    /// Turn a folded value back into a literal node, NULL when
+    /// the value has no literal form or is an error.
+    static Node *makeLiteral(Value v, int lineNum) {
+        if (v.isNumber()) {
+            return new NumberNode(v.asNumber(), "NUM", lineNum);
+        } else if (v.isBool()) {
+            return new BooleanNode(v.asBool(), v.asBool() ? "true" : "false", lineNum);
+        } else if (v.isString()) {
+            return new StringNode(v, "STRING", lineNum);
+        }
+        return NULL;
+    }
+
+    /// Fold an expression bottom up, returns the node to use in its place.
+    Node *fold(Node *node) {
+        if (node == NULL) {
+            return NULL;
+        }
+        switch (node->type) {
+            case NODE_BINARY_OP:
+                return foldBinaryOp(dynamic_cast<BinaryOpNode*>(node));
+            case NODE_UNARY_OP: {
+                UnaryOpNode *unaryOp = dynamic_cast<UnaryOpNode*>(node);
+                unaryOp->right = fold(unaryOp->right);
+                if (isConstant(unaryOp->right)) {
+                    Value v = applyUnaryOp(unaryOp->op, unaryOp->lineNum, constantValue(unaryOp->right));
+                    Node *literal = makeLiteral(v, unaryOp->lineNum);
+                    if (literal != NULL) {
+                        return literal;
+                    }
+                }
+                return node;
+            }
+            case NODE_CALL:
+                return foldCall(dynamic_cast<CallNode*>(node));
+            case NODE_EXPR_LIST: {
+                ExprListNode *list = dynamic_cast<ExprListNode*>(node);
+                for (size_t i = 0; i < list->exprs.size(); i++) {
+                    list->exprs[i] = fold(list->exprs[i]);
+                }
+                return node;
+            }
+            case NODE_MAP: {
+                MapNode *map = dynamic_cast<MapNode*>(node);
+                for (auto it = map->exprs.begin(); it != map->exprs.end(); it++) {
+                    it->first = fold(it->first);
+                    it->second = fold(it->second);
+                }
+                return node;
+            }
+            case NODE_INDEX: {
+                IndexNode *idx = dynamic_cast<IndexNode*>(node);
+                idx->index = fold(idx->index);
+                return node;
+            }
+            default:
+                return node;
+        }
+    }
+
+    /// Fold a binary operator and the operators down its left
+    /// operand. Generated code can chain many thousands of them,
+    /// so the chain is walked with a loop rather than recursion.
+    Node *foldBinaryOp(BinaryOpNode *top) {
+        std::vector<BinaryOpNode*> chain;
+        Node *left = top;
+        while (left->type == NODE_BINARY_OP) {
+            chain.push_back(dynamic_cast<BinaryOpNode*>(left));
+            left = chain.back()->left;
+        }
+        left = fold(left);
+        for (size_t i = chain.size(); i-- > 0;) {
+            BinaryOpNode *binaryOp = chain[i];
+            binaryOp->left = left;
+            binaryOp->right = fold(binaryOp->right);
+            left = binaryOp;
+            if (isConstant(binaryOp->left) && isConstant(binaryOp->right)) {
+                Value v = applyBinaryOp(binaryOp->op, binaryOp->lineNum,
+                    constantValue(binaryOp->left), constantValue(binaryOp->right));
+                Node *literal = makeLiteral(v, binaryOp->lineNum);
+                if (literal != NULL) {
+                    left = literal;
+                }
+            }
+        }
+        return left;
+    }
+
+    /// Call a pure builtin at compile time when every argument is
+    /// constant. A Sub may not share a builtin's name so the name
+    /// alone says which builtin it is.
+    Node *foldCall(CallNode *call) {
+        ExprListNode *args = dynamic_cast<ExprListNode*>(fold(call->args));
+        IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(call->ident);
+        auto it = builtins.find(identNode->ident);
+        // Wrong argument counts are left for the resolver to report
+        if (it == builtins.end() || !it->second->isPure() || args->exprs.size() != it->second->arity) {
+            return call;
+        }
+        std::vector<Value> valueArgs;
+        for (size_t i = 0; i < args->exprs.size(); i++) {
+            if (!isConstant(args->exprs[i])) {
+                return call;
+            }
+            valueArgs.push_back(constantValue(args->exprs[i]));
+        }
+        Node *literal = makeLiteral(it->second->execute(call->lineNum, ArgList(valueArgs.data(), valueArgs.size())), call->lineNum);
+        return literal != NULL ? literal : call;
+    }
+};
+
+/// Run the optimisation pass over a parsed program.
+void optimize(ProgramNode *prog, const std::map<std::string, Builtin*> &builtins) {
+    Optimizer optimizer(builtins);
+    optimizer.optimizeStmts(prog->getStmts());
+}
+
+/// Write the line for a single node indented by depth.
+static void writeLine(Node *node, int depth, const char *label) {
+    std::cout << std::string(depth * 2, ' ');
+    if (label != NULL) {
+        std::cout << label << ": ";
+    }
+    if (node == NULL) {
+        std::cout << "NONE" << std::endl;
+        return;
+    }
+    std::cout << node->token;
+    switch (node->type) {
+        case NODE_NUMBER:
+            std::cout << " " << dynamic_cast<NumberNode*>(node)->value.stringify();
+            break;
+        case NODE_STRING:
+            std::cout << " \"" << dynamic_cast<StringNode*>(node)->value.stringify() << "\"";
+            break;
+        case NODE_IDENTIFIER:
+            std::cout << " " << dynamic_cast<IdentifierNode*>(node)->ident;
+            break;
+        default:
+            break;
+    }
+    if (node->type != NODE_PROGRAM) {
+        std::cout << " (line " << node->lineNum << ")";
+    }
+    std::cout << std::endl;
+}
+
+static void writeNode(Node *node, int depth, const char *label);
+
+/// Write a binary operator and the operators down its left
+/// operand with a loop, as generated chains can be very long.
+static void writeBinaryOp(BinaryOpNode *top, int depth, const char *label) {
+    std::vector<BinaryOpNode*> chain;
+    Node *left = top;
+    while (left->type == NODE_BINARY_OP) {
+        chain.push_back(dynamic_cast<BinaryOpNode*>(left));
+        left = chain.back()->left;
+    }
+    for (size_t i = 0; i < chain.size(); i++) {
+        writeLine(chain[i], depth + i, i == 0 ? label : NULL);
+    }
+    writeNode(left, depth + chain.size(), NULL);
+    for (size_t i = chain.size(); i-- > 0;) {
+        writeNode(chain[i]->right, depth + i + 1, NULL);
+    }
+}
+
+/// Write a single node and its children indented by depth.
+static void writeNode(Node *node, int depth, const char *label) {
+    if (node != NULL && node->type == NODE_BINARY_OP) {
+        writeBinaryOp(dynamic_cast<BinaryOpNode*>(node), depth, label);
+        return;
+    }
+    writeLine(node, depth, label);
+    if (node == NULL) {
+        return;
+    }
+
+    depth++;
+    switch (node->type) {
+        case NODE_PROGRAM:
+        case NODE_BLOCK: {
+            NodeList *stmts = node->type == NODE_PROGRAM
+                ? dynamic_cast<ProgramNode*>(node)->getStmts()
+                : dynamic_cast<BlockNode*>(node)->getStmts();
+            for (size_t i = 0; i < stmts->size(); i++) {
+                writeNode((*stmts)[i], depth, NULL);
+            }
+            break;
+        }
+        case NODE_PRINT:
+            writeNode(dynamic_cast<PrintNode*>(node)->exp, depth, NULL);
+            break;
+        case NODE_UNARY_OP:
+            writeNode(dynamic_cast<UnaryOpNode*>(node)->right, depth, NULL);
+            break;
+        case NODE_VAR_ASSIGN:
+            writeNode(dynamic_cast<VarAssignNode*>(node)->ident, depth, NULL);
+            writeNode(dynamic_cast<VarAssignNode*>(node)->value, depth, NULL);
+            break;
+        case NODE_IF: {
+            IfNode *ifNode = dynamic_cast<IfNode*>(node);
+            writeNode(ifNode->expr, depth, "cond");
+            writeNode(ifNode->thenBranch, depth, "then");
+            if (ifNode->elseBranch != NULL) {
+                writeNode(ifNode->elseBranch, depth, "else");
+            }
+            break;
+        }
+        case NODE_WHILE:
+            writeNode(dynamic_cast<WhileNode*>(node)->expr, depth, "cond");
+            writeNode(dynamic_cast<WhileNode*>(node)->block, depth, NULL);
+            break;
+        case NODE_FOR: {
+            ForNode *forNode = dynamic_cast<ForNode*>(node);
+            writeNode(forNode->ident, depth, NULL);
+            writeNode(forNode->value, depth, "from");
+            writeNode(forNode->max, depth, "to");
+            if (forNode->step != NULL) {
+                writeNode(forNode->step, depth, "step");
+            }
+            if (forNode->sums != NULL) {
+                writeNode(forNode->sums, depth, "sum");
+            }
+            writeNode(forNode->block, depth, NULL);
+            break;
+        }
+        case NODE_SUB:
+            writeNode(dynamic_cast<SubNode*>(node)->ident, depth, NULL);
+            writeNode(dynamic_cast<SubNode*>(node)->params, depth, NULL);
+            writeNode(dynamic_cast<SubNode*>(node)->block, depth, NULL);
+            break;
+        case NODE_EXPR_LIST: {
+            ExprListNode *list = dynamic_cast<ExprListNode*>(node);
+            for (size_t i = 0; i < list->exprs.size(); i++) {
+                writeNode(list->exprs[i], depth, NULL);
+            }
+            break;
+        }
+        case NODE_MAP: {
+            MapNode *map = dynamic_cast<MapNode*>(node);
+            for (auto it = map->exprs.begin(); it != map->exprs.end(); it++) {
+                writeNode(it->first, depth, "key");
+                writeNode(it->second, depth, "value");
+            }
+            break;
+        }
+        case NODE_INDEX_ASSIGN: {
+            IndexAssignNode *idx = dynamic_cast<IndexAssignNode*>(node);
+            writeNode(idx->ident, depth, NULL);
+            writeNode(idx->index, depth, "index");
+            writeNode(idx->value, depth, NULL);
+            break;
+        }
+        case NODE_INDEX:
+            writeNode(dynamic_cast<IndexNode*>(node)->ident, depth, NULL);
+            writeNode(dynamic_cast<IndexNode*>(node)->index, depth, "index");
+            break;
+        case NODE_CALL:
+            writeNode(dynamic_cast<CallNode*>(node)->ident, depth, NULL);
+            writeNode(dynamic_cast<CallNode*>(node)->args, depth, NULL);
+            break;
+        case NODE_VAR_DECL:
+            writeNode(dynamic_cast<VarDeclNode*>(node)->ident, depth, NULL);
+            writeNode(dynamic_cast<VarDeclNode*>(node)->value, depth, NULL);
+            break;
+        case NODE_RETURN:
+            if (dynamic_cast<ReturnNode*>(node)->value != NULL) {
+                writeNode(dynamic_cast<ReturnNode*>(node)->value, depth, NULL);
+            }
+            break;
+        case NODE_EXPR:
+            writeNode(dynamic_cast<ExprNode*>(node)->expr, depth, NULL);
+            break;
+        default:
+            break;
+    }
+}
+
+/// Helper to print the AST to stdout, one node per line.
+void writeAst(Node *root) {
+    writeNode(root, 0, NULL);
+}
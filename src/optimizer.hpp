@@ -0,0 +1,9 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "node.hpp"
+
+void optimize(ProgramNode *prog, const std::map<std::string, Builtin*> &builtins);
+void writeAst(Node *root);
@@ -0,0 +1,46 @@
+#include "output.hpp"
+
+#include <cstdio>
+#include <unistd.h>
+
+static char outputBuffer[1 << 16];
+
+/// Give stdout a large buffer, line buffered when a person is
+/// watching a terminal. Must run before anything is written.
+void initOutput() {
+    int mode = isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF;
+    setvbuf(stdout, outputBuffer, mode, sizeof(outputBuffer));
+}
+
+/// Write a value and a newline. Numbers, booleans and strings
+/// are formatted straight into the buffer without allocating.
+/// Lines printed by Parallel For iterations or by interpreters
+/// on other threads are kept whole.
+void printValue(const Value &v) {
+    flockfile(stdout);
+    switch (v.type()) {
+        case VAL_NUMBER:
+            fprintf(stdout, "%f\n", v.asNumber());
+            break;
+        case VAL_BOOL:
+            fputs(v.asBool() ? "True\n" : "False\n", stdout);
+            break;
+        case VAL_STRING: {
+            StringRef s(v);
+            fwrite(s.data(), 1, s.size(), stdout);
+            putc('\n', stdout);
+            break;
+        }
+        default: {
+            std::string s = v.stringify();
+            fwrite(s.data(), 1, s.size(), stdout);
+            putc('\n', stdout);
+            break;
+        }
+    }
+    funlockfile(stdout);
+}
+
+void flushOutput() {
+    fflush(stdout);
+}
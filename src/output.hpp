@@ -0,0 +1,11 @@
+#pragma once
+
+#include "value.hpp"
+
+// Buffered standard output for Print. Output is flushed when the
+// buffer fills, before input is read and at exit, or after every
+// line when stdout is a terminal. Anything written with std::cout
+// shares the same buffer so ordering is kept.
+void initOutput();
+void printValue(const Value &v);
+void flushOutput();
@@ -3,17 +3,37 @@
 #include <cstdio>
 #include <cstring>
 #include "node.hpp"
-int yylex();
-int yyerror(char *s);
-int lines = 1;
-extern Node *root;
 %}
+%code requires {
+#include "node.hpp"
+#include "buffer.hpp"
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void *yyscan_t;
+#endif
+
+/// Everything one parse changes, handed to the lexer and every
+/// action so separate parses may run on separate threads.
+struct ParseState {
+    Node *root = NULL;     // The program parsed so far
+    int lines = 1;         // Line the parser has reached
+    LiteralBuffer literal; // String literal being lexed
+};
+}
+%code {
+int yylex(YYSTYPE *yylval, yyscan_t scanner);
+int yyerror(ParseState *state, yyscan_t scanner, const char *s);
+}
+%define api.pure full
+%parse-param {ParseState *state} {yyscan_t scanner}
+%lex-param {yyscan_t scanner}
 %error-verbose
 %union {
     Node *node;
     double number;
     int boolean;
-    char *string;
+    const char *string;
 }
 %start program
 %token NUMBER STRING TRUE FALSE
@@ -26,7 +46,7 @@ extern Node *root;
 %token ELSE THEN WHILE FOR 
 %token LET TO STEP END_IF 
 %token SUB END_WHILE END_FOR END_SUB
-%token DO
+%token DO RETURN PARALLEL SUM
 
 %right EQUALS
 %left PLUS MINUS
@@ -40,9 +60,10 @@ extern Node *root;
 %type<node> or_expr and_expr equality_expr relational_expr
 %type<node> add_expr if_stmt block_stmt unmatched_if_stmt 
 %type<node> matched_if_stmt while_stmt for_stmt sub_stmt
-%type<node> call_stmt list expr_list expr_list_ext index
+%type<node> call list expr_list expr_list_ext index
 %type<node> map map_list map_list_ext index_assign_stmt
-%type<node> builtin arg_list arg_list_ext expr_stmt
+%type<node> arg_list arg_list_ext expr_stmt return_stmt var_stmt
+%type<node> param_list param_list_ext sum_clause
 %type<number> NUMBER
 %type<string> STRING
 %type<string> IDENT
@@ -51,7 +72,7 @@ extern Node *root;
 
 program: stmts;
 
-stmts: { $$ = new ProgramNode("PROG"); root = $$; }
+stmts: { $$ = new ProgramNode("PROG"); state->root = $$; }
     | stmts stmt { 
         if ($2 != NULL) {
             (dynamic_cast<ProgramNode*>($1))->addNode($2);
@@ -67,30 +88,58 @@ stmt: end { $$ = NULL; }
     | while_stmt end { $$ = $1; }
     | for_stmt end { $$ = $1; }
     | sub_stmt end { $$ = $1; }
-    | call_stmt end { $$ = $1; }
     | index_assign_stmt end { $$ = $1; }
+    | return_stmt end { $$ = $1; }
+    | var_stmt end { $$ = $1; }
+    ;
+
+expr_stmt: expr { $$ = new ExprNode($1, "EXPR", state->lines); }
+    ;
+
+index_assign_stmt: ident LEFT_BRACKET expr RIGHT_BRACKET EQUALS expr { $$ = new IndexAssignNode($1, $3, $6, "INDEX_ASSIGN", state->lines); }
     ;
 
-expr_stmt: expr { $$ = new ExprNode($1, "EXPR", lines); }
+sub_stmt: SUB ident LEFT_PAREN param_list RIGHT_PAREN end block_stmt END_SUB { $$ = new SubNode($2, $4, $7, "SUB", state->lines); }
     ;
 
-index_assign_stmt: ident LEFT_BRACKET expr RIGHT_BRACKET EQUALS expr { $$ = new IndexAssignNode($1, $3, $6, "INDEX_ASSIGN", lines); }
+param_list: { $$ = new ExprListNode("PARAMS", state->lines); }
+    | ident { $$ = new ExprListNode("PARAMS", state->lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
+    | param_list_ext COMMA ident { $$ = $1; (dynamic_cast<ExprListNode*>($$))->addNode($3); }
     ;
 
-call_stmt: ident LEFT_PAREN RIGHT_PAREN { $$ = new CallNode($1, "CALL", lines); }
+param_list_ext: ident { $$ = new ExprListNode("PARAMS", state->lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
+    | param_list_ext COMMA ident { $$ = $1; (dynamic_cast<ExprListNode*>($$))->addNode($3); }
     ;
 
-sub_stmt: SUB ident LEFT_PAREN RIGHT_PAREN end block_stmt END_SUB { $$ = new SubNode($2, $6, "SUB", lines); }
+return_stmt: RETURN { $$ = new ReturnNode(NULL, "RETURN", state->lines); }
+    | RETURN expr { $$ = new ReturnNode($2, "RETURN", state->lines); }
+    ;
+
+var_stmt: VAR ident EQUALS expr { $$ = new VarDeclNode($2, $4, "VAR", state->lines); }
+    ;
+
+for_stmt: FOR LET ident EQUALS expr TO expr DO end block_stmt END_FOR { $$ = new ForNode($3, $5, $7, NULL, $10, "FOR", state->lines);}
+    | FOR LET ident EQUALS expr TO expr STEP expr DO end block_stmt END_FOR { $$ = new ForNode($3, $5, $7, $9, $12, "FOR", state->lines); }
+    | FOR LET ident EQUALS expr TO expr PARALLEL sum_clause DO end block_stmt END_FOR {
+        ForNode *forNode = new ForNode($3, $5, $7, NULL, $12, "PARALLEL_FOR", state->lines);
+        forNode->makeParallel($9);
+        $$ = forNode;
+    }
+    | FOR LET ident EQUALS expr TO expr STEP expr PARALLEL sum_clause DO end block_stmt END_FOR {
+        ForNode *forNode = new ForNode($3, $5, $7, $9, $14, "PARALLEL_FOR", state->lines);
+        forNode->makeParallel($11);
+        $$ = forNode;
+    }
     ;
 
-for_stmt: FOR LET ident EQUALS expr TO expr DO end block_stmt END_FOR { $$ = new ForNode($3, $5, $7, NULL, $10, "FOR", lines);}
-    | FOR LET ident EQUALS expr TO expr STEP expr DO end block_stmt END_FOR { $$ = new ForNode($3, $5, $7, $9, $12, "FOR", lines); }
+sum_clause: { $$ = NULL; }
+    | SUM param_list_ext { $$ = $2; }
     ;
 
-while_stmt: WHILE expr DO end block_stmt END_WHILE { $$ = new WhileNode($2, $5, "WHILE", lines); }
+while_stmt: WHILE expr DO end block_stmt END_WHILE { $$ = new WhileNode($2, $5, "WHILE", state->lines); }
     ;
 
-block_stmt: { $$ = new BlockNode("BLOCK", lines); }
+block_stmt: { $$ = new BlockNode("BLOCK", state->lines); }
     | block_stmt stmt { 
         if ($2 != NULL) {
             (dynamic_cast<BlockNode*>($1))->addNode($2);
@@ -102,112 +151,112 @@ if_stmt: unmatched_if_stmt { $$ = $1; }
     | matched_if_stmt { $$ = $1; }
     ;
 
-unmatched_if_stmt: IF expr THEN end block_stmt END_IF %prec IF_UNMAT { $$ = new IfNode($2, $5, NULL, "IF", lines); }
+unmatched_if_stmt: IF expr THEN end block_stmt END_IF %prec IF_UNMAT { $$ = new IfNode($2, $5, NULL, "IF", state->lines); }
     ;
 
-matched_if_stmt: IF expr THEN end block_stmt ELSE end block_stmt END_IF { $$ = new IfNode($2, $5, $8, "IF", lines); }
-    | IF expr THEN end block_stmt ELSE if_stmt { $$ = new IfNode($2, $5, $7, "IF", lines); }
+matched_if_stmt: IF expr THEN end block_stmt ELSE end block_stmt END_IF { $$ = new IfNode($2, $5, $8, "IF", state->lines); }
+    | IF expr THEN end block_stmt ELSE if_stmt { $$ = new IfNode($2, $5, $7, "IF", state->lines); }
     ;
 
-assign_stmt: ident EQUALS expr { $$ = new VarAssignNode($1, $3, "ASSIGN", lines); };
+assign_stmt: ident EQUALS expr { $$ = new VarAssignNode($1, $3, "ASSIGN", state->lines); };
 
-print_stmt: PRINT LEFT_PAREN expr RIGHT_PAREN { $$ = new PrintNode($3, "PRINT", lines); }
+print_stmt: PRINT LEFT_PAREN expr RIGHT_PAREN { $$ = new PrintNode($3, "PRINT", state->lines); }
     ;
 
-ident: IDENT { $$ = new IdentifierNode(yylval.string, "IDENT", lines); }
+ident: IDENT { $$ = new IdentifierNode($1, "IDENT", state->lines); }
     ;
 
 expr: conditional_expr { $$ = $1; };
 
-conditional_expr: or_expr { $$ = $1 };
+conditional_expr: or_expr { $$ = $1; };
 
 or_expr: and_expr { $$ = $1; }
-    | or_expr OR and_expr { $$ = new BinaryOpNode($1, $3, 'O', "or", lines); }
+    | or_expr OR and_expr { $$ = new BinaryOpNode($1, $3, 'O', "or", state->lines); }
     ;
 
 and_expr: equality_expr { $$ = $1; }
-    | and_expr AND equality_expr { $$ = new BinaryOpNode($1, $3, 'A', "and", lines); }
+    | and_expr AND equality_expr { $$ = new BinaryOpNode($1, $3, 'A', "and", state->lines); }
     ;
 
 equality_expr: relational_expr { $$ = $1; }
-    | equality_expr EQUALS_EQUALS relational_expr { $$ = new BinaryOpNode($1, $3, 'E', "==", lines); }
+    | equality_expr EQUALS_EQUALS relational_expr { $$ = new BinaryOpNode($1, $3, 'E', "==", state->lines); }
     ;
 
 relational_expr: add_expr { $$ = $1; }
-    | relational_expr LESS_THAN add_expr { $$ = new BinaryOpNode($1, $3, '<', "<", lines); }
-    | relational_expr GREATER_THAN add_expr { $$ = new BinaryOpNode($1, $3, '>', ">", lines); }
-    | relational_expr LESS_THAN_EQUALS add_expr { $$ = new BinaryOpNode($1, $3, 'L', "<=", lines); }
-    | relational_expr GREATER_THAN_EQUALS add_expr { $$ = new BinaryOpNode($1, $3, 'G', "<", lines); }
+    | relational_expr LESS_THAN add_expr { $$ = new BinaryOpNode($1, $3, '<', "<", state->lines); }
+    | relational_expr GREATER_THAN add_expr { $$ = new BinaryOpNode($1, $3, '>', ">", state->lines); }
+    | relational_expr LESS_THAN_EQUALS add_expr { $$ = new BinaryOpNode($1, $3, 'L', "<=", state->lines); }
+    | relational_expr GREATER_THAN_EQUALS add_expr { $$ = new BinaryOpNode($1, $3, 'G', ">=", state->lines); }
     ;
 
 add_expr: term { $$ = $1; }
-    | expr PLUS term { $$ = new BinaryOpNode($1, $3, '+', "+", lines); }
-    | expr MINUS term { $$ = new BinaryOpNode($1, $3, '-', "-", lines); }
+    | expr PLUS term { $$ = new BinaryOpNode($1, $3, '+', "+", state->lines); }
+    | expr MINUS term { $$ = new BinaryOpNode($1, $3, '-', "-", state->lines); }
     ;
 
 term: factor { $$ = $1; }
-    | term TIMES factor { $$ = new BinaryOpNode($1, $3, '*', "*", lines); }
-    | term DIVIDE factor { $$ = new BinaryOpNode($1, $3, '/', "/", lines); }
+    | term TIMES factor { $$ = new BinaryOpNode($1, $3, '*', "*", state->lines); }
+    | term DIVIDE factor { $$ = new BinaryOpNode($1, $3, '/', "/", state->lines); }
     ;
 
-factor: NUMBER { $$ = new NumberNode(yylval.number, "NUM", lines); }
+factor: NUMBER { $$ = new NumberNode($1, "NUM", state->lines); }
     | ident { $$ = $1; }
-    | STRING { $$ = new StringNode(yylval.string, "STRING", lines); }
-    | TRUE { $$ = new BooleanNode(true, "true", lines); }
-    | FALSE { $$ = new BooleanNode(false, "false", lines); }
+    | STRING { $$ = new StringNode($1, "STRING", state->lines); }
+    | TRUE { $$ = new BooleanNode(true, "true", state->lines); }
+    | FALSE { $$ = new BooleanNode(false, "false", state->lines); }
     | LEFT_PAREN expr RIGHT_PAREN { $$ = $2; }
-    | MINUS expr %prec U_MINUS { $$ = new UnaryOpNode($2, '-', "UNARY", lines); }
+    | MINUS expr %prec U_MINUS { $$ = new UnaryOpNode($2, '-', "UNARY", state->lines); }
     | index { $$ = $1; }
     | list { $$ = $1; }
     | map { $$ = $1; }
-    | builtin { $$ = $1; }
+    | call { $$ = $1; }
     ;
 
-builtin: ident LEFT_PAREN arg_list RIGHT_PAREN { $$ = new BuiltInNode($1, $3, "BUILTIN", lines); }
+call: ident LEFT_PAREN arg_list RIGHT_PAREN { $$ = new CallNode($1, $3, "CALL", state->lines); }
     ;
 
-arg_list: { $$ = new ExprListNode("ARGS", lines); }
-    | expr { $$ = new ExprListNode("ARGS", lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
+arg_list: { $$ = new ExprListNode("ARGS", state->lines); }
+    | expr { $$ = new ExprListNode("ARGS", state->lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
     | arg_list_ext COMMA expr { $$ = $1; (dynamic_cast<ExprListNode*>($$))->addNode($3); }
     ;
 
-arg_list_ext: expr { $$ = new ExprListNode("ARGS", lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
+arg_list_ext: expr { $$ = new ExprListNode("ARGS", state->lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
     | arg_list_ext COMMA expr         { $$ = $1; (dynamic_cast<ExprListNode*>($$))->addNode($3); }
     ;
 
-index: ident LEFT_BRACKET expr RIGHT_BRACKET { $$ = new IndexNode($1, $3, "INDEX", lines); }
+index: ident LEFT_BRACKET expr RIGHT_BRACKET { $$ = new IndexNode($1, $3, "INDEX", state->lines); }
     ;
 
 map: LEFT_BRACE map_list RIGHT_BRACE { $$ = $2; }
     ;
 
-map_list: { $$ = new MapNode("MAP", lines); }
-    | expr COLON expr { $$ = new MapNode("MAP", lines); (dynamic_cast<MapNode*>($$))->addNode($1, $3); }
+map_list: { $$ = new MapNode("MAP", state->lines); }
+    | expr COLON expr { $$ = new MapNode("MAP", state->lines); (dynamic_cast<MapNode*>($$))->addNode($1, $3); }
     | map_list_ext COMMA expr COLON expr { $$ = $1; (dynamic_cast<MapNode*>($$))->addNode($3, $5); }
     ;
 
-map_list_ext: expr COLON expr { $$ = new MapNode("MAP", lines); (dynamic_cast<MapNode*>($$))->addNode($1, $3); }
+map_list_ext: expr COLON expr { $$ = new MapNode("MAP", state->lines); (dynamic_cast<MapNode*>($$))->addNode($1, $3); }
     | map_list_ext COMMA expr COLON expr { $$ = $1; (dynamic_cast<MapNode*>($$))->addNode($3, $5); }
     ;
 
 list: LEFT_BRACKET expr_list RIGHT_BRACKET { $$ = $2; }
     ;
 
-expr_list: { $$ = new ExprListNode("LIST", lines); }
-    | expr { $$ = new ExprListNode("LIST", lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
+expr_list: { $$ = new ExprListNode("LIST", state->lines); }
+    | expr { $$ = new ExprListNode("LIST", state->lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
     | expr_list_ext COMMA expr { $$ = $1; (dynamic_cast<ExprListNode*>($$))->addNode($3); }
     ;
 
-expr_list_ext: expr { $$ = new ExprListNode("LIST", lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
+expr_list_ext: expr { $$ = new ExprListNode("LIST", state->lines); (dynamic_cast<ExprListNode*>($$))->addNode($1); }
     | expr_list_ext COMMA expr { $$ = $1; (dynamic_cast<ExprListNode*>($$))->addNode($3); }
     ;
 
-end: END { lines++; }
+end: END { state->lines++; }
     ;
 
 %%
 
-int yyerror(char *s) {
-    fprintf(stderr, "%s at line %d\n", s, lines);
+int yyerror(ParseState *state, yyscan_t scanner, const char *s) {
+    fprintf(stderr, "%s at line %d\n", s, state->lines);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#include "profiler.hpp"
+#include "value.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <vector>
+
+Profiler::Profiler() {
+    this->currentSub = NULL;
+    this->currentStack = 0;
+    this->currentLine = 0;
+    this->lastAllocated = 0;
+}
+
+Profiler::Stats &Profiler::statsForLine(int lineNum) {
+    if (lineNum >= (int)lineStats.size()) {
+        lineStats.resize(lineNum + 1);
+    }
+    return lineStats[lineNum];
+}
+
+/// Charge the time and allocations since the last mark to the
+/// current line, the Sub on top of the stack and its call stack.
+void Profiler::charge() {
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - lastMark).count();
+    size_t allocated = gcStats.allocated - lastAllocated;
+    lastMark = now;
+    lastAllocated = gcStats.allocated;
+
+    if (currentLine > 0) {
+        Stats &line = lineStats[currentLine];
+        line.exclusive += elapsed;
+        line.allocations += allocated;
+    }
+    currentSub->exclusive += elapsed;
+    currentSub->allocations += allocated;
+    stacks[currentStack].exclusive += elapsed;
+}
+
+void Profiler::start() {
+    stacks.push_back({-1, "main", 0});
+    currentSub = &subStats["main"];
+    currentSub->hits = 1;
+    currentSub->active = 1;
+    lastMark = Clock::now();
+    lastAllocated = gcStats.allocated;
+}
+
+/// Called as each statement starts executing.
+void Profiler::line(int lineNum) {
+    charge();
+    currentLine = lineNum;
+    statsForLine(lineNum).hits++;
+}
+
+void Profiler::enterSub(const std::string &name) {
+    charge();
+    Stats *sub = &subStats[name];
+    sub->hits++;
+    sub->active++;
+    double callerExclusive = 0;
+    if (currentLine > 0) {
+        lineStats[currentLine].active++;
+        callerExclusive = lineStats[currentLine].exclusive;
+    }
+
+    auto key = std::make_pair(currentStack, name);
+    auto it = stackChildren.find(key);
+    int stack;
+    if (it == stackChildren.end()) {
+        stack = stacks.size();
+        stacks.push_back({currentStack, name, 0});
+        stackChildren[key] = stack;
+    } else {
+        stack = it->second;
+    }
+
+    frames.push_back({sub, stack, lastMark, currentLine, callerExclusive});
+    currentSub = sub;
+    currentStack = stack;
+}
+
+void Profiler::exitSub() {
+    charge();
+    Frame frame = frames.back();
+    frames.pop_back();
+    currentSub = frames.empty() ? &subStats["main"] : frames.back().sub;
+    currentStack = stacks[frame.stack].parent;
+
+    double elapsed = std::chrono::duration<double>(lastMark - frame.entered).count();
+    if (--frame.sub->active == 0) {
+        frame.sub->inclusive += elapsed;
+    }
+    // The calling line includes the time spent in the Sub, less what
+    // a recursive call charged to the same line directly.
+    if (frame.callerLine > 0) {
+        Stats &line = lineStats[frame.callerLine];
+        if (--line.active == 0) {
+            line.callee += elapsed - (line.exclusive - frame.callerStartExclusive);
+        }
+    }
+    currentLine = frame.callerLine;
+}
+
+static std::string trim(const std::string &s) {
+    size_t start = s.find_first_not_of(" \t");
+    if (start == std::string::npos) {
+        return "";
+    }
+    return s.substr(start);
+}
+
+/// Print the per line and per Sub tables sorted by exclusive time
+/// and write the call stacks in folded format beside the source.
+void Profiler::write(const char *sourcePath) {
+    charge();
+    subStats["main"].inclusive = subStats["main"].exclusive;
+    for (auto it = subStats.begin(); it != subStats.end(); it++) {
+        if (it->first != "main") {
+            subStats["main"].inclusive += it->second.exclusive;
+        }
+    }
+
+    std::vector<std::pair<int, Stats>> lines;
+    for (size_t i = 0; i < lineStats.size(); i++) {
+        if (lineStats[i].hits > 0) {
+            lineStats[i].inclusive = lineStats[i].exclusive + lineStats[i].callee;
+            lines.push_back(std::make_pair((int)i, lineStats[i]));
+        }
+    }
+
+    std::vector<std::string> source;
+    std::ifstream file(sourcePath);
+    std::string text;
+    while (std::getline(file, text)) {
+        source.push_back(trim(text));
+    }
+
+    std::sort(lines.begin(), lines.end(), [](const std::pair<int, Stats> &l, const std::pair<int, Stats> &r) {
+        return l.second.exclusive > r.second.exclusive;
+    });
+    std::vector<std::pair<std::string, Stats>> subs(subStats.begin(), subStats.end());
+    std::sort(subs.begin(), subs.end(), [](const std::pair<std::string, Stats> &l, const std::pair<std::string, Stats> &r) {
+        return l.second.exclusive > r.second.exclusive;
+    });
+
+    std::ostream &out = std::cout;
+    out << "-- Profile Start --" << std::endl;
+    out << std::fixed << std::setprecision(3);
+    out << std::setw(6) << "line" << std::setw(12) << "hits" << std::setw(12) << "excl ms"
+        << std::setw(12) << "incl ms" << std::setw(10) << "allocs" << "  source" << std::endl;
+    for (size_t i = 0; i < lines.size(); i++) {
+        int lineNum = lines[i].first;
+        Stats &s = lines[i].second;
+        std::string code = lineNum >= 1 && lineNum <= (int)source.size() ? source[lineNum - 1] : "";
+        out << std::setw(6) << lineNum << std::setw(12) << s.hits << std::setw(12) << s.exclusive * 1000
+            << std::setw(12) << s.inclusive * 1000 << std::setw(10) << s.allocations << "  " << code << std::endl;
+    }
+    out << std::endl;
+    out << std::setw(18) << "sub" << std::setw(12) << "calls" << std::setw(12) << "excl ms"
+        << std::setw(12) << "incl ms" << std::setw(10) << "allocs" << std::endl;
+    for (size_t i = 0; i < subs.size(); i++) {
+        Stats &s = subs[i].second;
+        out << std::setw(18) << subs[i].first << std::setw(12) << s.hits << std::setw(12) << s.exclusive * 1000
+            << std::setw(12) << s.inclusive * 1000 << std::setw(10) << s.allocations << std::endl;
+    }
+
+    std::string foldedPath = std::string(sourcePath) + ".folded";
+    std::ofstream folded(foldedPath);
+    for (size_t i = 0; i < stacks.size(); i++) {
+        // Weights are whole microseconds, as flamegraph tools expect integers
+        long long micros = (long long)(stacks[i].exclusive * 1e6);
+        if (micros <= 0) {
+            continue;
+        }
+        std::string path = stacks[i].name;
+        for (int parent = stacks[i].parent; parent >= 0; parent = stacks[parent].parent) {
+            path = stacks[parent].name + ";" + path;
+        }
+        folded << path << " " << micros << std::endl;
+    }
+    out << "Folded stacks written to " << foldedPath << std::endl;
+    out << "-- Profile End --" << std::endl;
+    out << std::defaultfloat;
+}
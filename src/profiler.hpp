@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+// Statement and Sub level profiler used by --profile. The evaluator
+// and VM call these hooks only when profiling is switched on.
+class Profiler {
+public:
+    Profiler();
+    void start();
+    void line(int lineNum);
+    void enterSub(const std::string &name);
+    void exitSub();
+    void write(const char *sourcePath);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    /// Counters for one source line or one Sub.
+    struct Stats {
+        long long hits = 0;
+        double exclusive = 0;  // Seconds spent in the line or Sub itself
+        double inclusive = 0;  // Including the Subs it called
+        double callee = 0;     // Time in Subs called from this line
+        size_t allocations = 0;
+        int active = 0;        // Live activations, so recursion is counted once
+    };
+
+    /// A Sub activation on the profiler's call stack.
+    struct Frame {
+        Stats *sub;
+        int stack;
+        Clock::time_point entered;
+        int callerLine;
+        double callerStartExclusive;
+    };
+
+    /// One distinct call stack, stored as a tree of Sub names.
+    struct Stack {
+        int parent;
+        std::string name;
+        double exclusive;
+    };
+
+    std::vector<Stats> lineStats; // Indexed by line number
+    std::map<std::string, Stats> subStats;
+    std::vector<Stack> stacks;
+    std::map<std::pair<int, std::string>, int> stackChildren;
+    std::vector<Frame> frames;
+    Stats *currentSub;
+    int currentStack;
+    int currentLine;
+    Clock::time_point lastMark;
+    size_t lastAllocated;
+
+    Stats &statsForLine(int lineNum);
+    void charge();
+};
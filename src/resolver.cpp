@@ -0,0 +1,397 @@
+#include "resolver.hpp"
+#include "interpreter.hpp"
+#include "builtin.hpp"
+
+#include <unordered_map>
+
+/// Walks the AST once after parsing and gives every variable
+/// identifier a slot. Inside a Sub parameters and Var
+/// declarations get a slot in the Sub's frame, every other
+/// variable is a global. Calls are bound to their SubNode or
+/// Builtin and have their arity checked, the first problem
+/// found is kept in error. The globals and Subs it finds are
+/// kept by the Interpreter so later expressions see the same slots.
+class Resolver {
+public:
+    Resolver(Interpreter *interp) : slots(interp->slots), subs(interp->subs),
+        globalNames(interp->globalNames), builtins(interp->builtins) {
+        this->currentSub = NULL;
+        this->inParallel = false;
+    }
+
+    /// Find every Sub up front so calls may come before
+    /// the definition.
+    void collectSubs(Node *node) {
+        if (node == NULL) {
+            return;
+        }
+        switch (node->type) {
+            case NODE_PROGRAM:
+                collectStmts(dynamic_cast<ProgramNode*>(node)->getStmts());
+                break;
+            case NODE_BLOCK:
+                collectStmts(dynamic_cast<BlockNode*>(node)->getStmts());
+                break;
+            case NODE_IF:
+                collectSubs(dynamic_cast<IfNode*>(node)->thenBranch);
+                collectSubs(dynamic_cast<IfNode*>(node)->elseBranch);
+                break;
+            case NODE_WHILE:
+                collectSubs(dynamic_cast<WhileNode*>(node)->block);
+                break;
+            case NODE_FOR:
+                collectSubs(dynamic_cast<ForNode*>(node)->block);
+                break;
+            case NODE_SUB: {
+                SubNode *sub = dynamic_cast<SubNode*>(node);
+                const char *name = dynamic_cast<IdentifierNode*>(sub->ident)->ident;
+                if (builtins.find(name) != builtins.end()) {
+                    setError(makeError(sub->lineNum, "Cannot define a Sub with the name of a builtin!"));
+                }
+                subs[name] = sub;
+                collectSubs(sub->block);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    /// Hand back the first error found and reset it.
+    Value takeError() {
+        Value e = error;
+        error = Value::null();
+        return e;
+    }
+
+    void resolveNode(Node *node) {
+        if (node == NULL) {
+            return;
+        }
+        switch (node->type) {
+            case NODE_PROGRAM:
+                resolveStmts(dynamic_cast<ProgramNode*>(node)->getStmts());
+                break;
+            case NODE_BLOCK:
+                resolveStmts(dynamic_cast<BlockNode*>(node)->getStmts());
+                break;
+            case NODE_IDENTIFIER:
+                resolveIdent(node);
+                break;
+            case NODE_PRINT:
+                resolveNode(dynamic_cast<PrintNode*>(node)->exp);
+                break;
+            case NODE_BINARY_OP: {
+                // Long generated chains nest down the left operand,
+                // walk it with a loop and resolve left to right
+                std::vector<BinaryOpNode*> chain;
+                Node *left = node;
+                while (left->type == NODE_BINARY_OP) {
+                    chain.push_back(dynamic_cast<BinaryOpNode*>(left));
+                    left = chain.back()->left;
+                }
+                resolveNode(left);
+                for (size_t i = chain.size(); i-- > 0;) {
+                    resolveNode(chain[i]->right);
+                }
+                break;
+            }
+            case NODE_UNARY_OP:
+                resolveNode(dynamic_cast<UnaryOpNode*>(node)->right);
+                break;
+            case NODE_VAR_ASSIGN: {
+                VarAssignNode *assign = dynamic_cast<VarAssignNode*>(node);
+                resolveIdent(assign->ident);
+                resolveNode(assign->value);
+                break;
+            }
+            case NODE_IF: {
+                IfNode *ifNode = dynamic_cast<IfNode*>(node);
+                resolveNode(ifNode->expr);
+                resolveNode(ifNode->thenBranch);
+                resolveNode(ifNode->elseBranch);
+                break;
+            }
+            case NODE_WHILE: {
+                WhileNode *whileNode = dynamic_cast<WhileNode*>(node);
+                resolveNode(whileNode->expr);
+                resolveNode(whileNode->block);
+                break;
+            }
+            case NODE_FOR: {
+                ForNode *forNode = dynamic_cast<ForNode*>(node);
+                if (forNode->parallel) {
+                    resolveParallelFor(forNode);
+                    break;
+                }
+                resolveIdent(forNode->ident);
+                resolveNode(forNode->value);
+                resolveNode(forNode->max);
+                resolveNode(forNode->step);
+                resolveNode(forNode->block);
+                break;
+            }
+            case NODE_SUB:
+                resolveSub(dynamic_cast<SubNode*>(node));
+                break;
+            case NODE_CALL:
+                resolveCall(dynamic_cast<CallNode*>(node), false);
+                break;
+            case NODE_VAR_DECL: {
+                VarDeclNode *decl = dynamic_cast<VarDeclNode*>(node);
+                resolveNode(decl->value);
+                if (currentSub != NULL) {
+                    declareLocal(decl->ident);
+                } else {
+                    resolveIdent(decl->ident);
+                }
+                break;
+            }
+            case NODE_RETURN:
+                if (currentSub == NULL) {
+                    setError(makeError(node->lineNum, "Return can only be used inside a Sub!"));
+                } else if (inParallel) {
+                    setError(makeError(node->lineNum, "Return cannot be used inside a Parallel For!"));
+                }
+                resolveNode(dynamic_cast<ReturnNode*>(node)->value);
+                break;
+            case NODE_EXPR_LIST: {
+                ExprListNode *list = dynamic_cast<ExprListNode*>(node);
+                for (size_t i = 0; i < list->exprs.size(); i++) {
+                    resolveNode(list->exprs[i]);
+                }
+                break;
+            }
+            case NODE_MAP: {
+                MapNode *map = dynamic_cast<MapNode*>(node);
+                for (auto it = map->exprs.begin(); it != map->exprs.end(); it++) {
+                    resolveNode(it->first);
+                    resolveNode(it->second);
+                }
+                break;
+            }
+            case NODE_INDEX_ASSIGN: {
+                IndexAssignNode *idx = dynamic_cast<IndexAssignNode*>(node);
+                resolveIdent(idx->ident);
+                resolveNode(idx->index);
+                resolveNode(idx->value);
+                break;
+            }
+            case NODE_INDEX: {
+                IndexNode *idx = dynamic_cast<IndexNode*>(node);
+                resolveIdent(idx->ident);
+                resolveNode(idx->index);
+                break;
+            }
+            case NODE_EXPR: {
+                Node *expr = dynamic_cast<ExprNode*>(node)->expr;
+                if (expr != NULL && expr->type == NODE_CALL) {
+                    resolveCall(dynamic_cast<CallNode*>(expr), true);
+                } else {
+                    resolveNode(expr);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+private:
+    std::unordered_map<const char*, int> &slots;     // Keyed by interned ident
+    std::unordered_map<const char*, SubNode*> &subs; // Every Sub by name
+    std::vector<std::string> &globalNames;           // Slot to name table
+    const std::map<std::string, Builtin*> &builtins; // Small Basic standard lib
+    std::unordered_map<const char*, int> locals;     // Locals of currentSub
+    SubNode *currentSub;                             // NULL at the top level
+    bool inParallel;                                 // currentSub is a Parallel For body
+    Value error;
+
+    void collectStmts(NodeList *stmts) {
+        for (size_t i = 0; i < stmts->size(); i++) {
+            collectSubs((*stmts)[i]);
+        }
+    }
+
+    void resolveStmts(NodeList *stmts) {
+        for (size_t i = 0; i < stmts->size(); i++) {
+            resolveNode((*stmts)[i]);
+        }
+    }
+
+    /// Resolve a Sub body in a fresh local scope holding its parameters.
+    /// A Parallel For body also makes every variable it assigns a local.
+    void resolveSub(SubNode *sub, bool parallel = false) {
+        SubNode *outerSub = currentSub;
+        bool outerParallel = inParallel;
+        std::unordered_map<const char*, int> outerLocals;
+        outerLocals.swap(locals);
+        currentSub = sub;
+        inParallel = parallel;
+        ExprListNode *params = dynamic_cast<ExprListNode*>(sub->params);
+        for (size_t i = 0; i < params->exprs.size(); i++) {
+            declareLocal(params->exprs[i]);
+        }
+        if (parallel) {
+            declareAssigned(sub->block);
+        }
+        resolveNode(sub->block);
+        currentSub = outerSub;
+        inParallel = outerParallel;
+        locals.swap(outerLocals);
+    }
+
+    /// Turn the body of a Parallel For into a Sub taking the counter
+    /// and the sums. The bounds and the variables summed into are
+    /// resolved where the loop is, the body only shares globals it reads.
+    void resolveParallelFor(ForNode *forNode) {
+        int lineNum = forNode->lineNum;
+        if (currentSub != NULL) {
+            setError(makeError(lineNum, "Parallel For can only be used outside of a Sub!"));
+            return;
+        }
+        resolveNode(forNode->value);
+        resolveNode(forNode->max);
+        resolveNode(forNode->step);
+        ExprListNode *params = new ExprListNode("PARAMS", lineNum);
+        params->addNode(forNode->ident);
+        ExprListNode *sums = dynamic_cast<ExprListNode*>(forNode->sums);
+        for (size_t i = 0; sums != NULL && i < sums->exprs.size(); i++) {
+            IdentifierNode *sum = dynamic_cast<IdentifierNode*>(sums->exprs[i]);
+            for (size_t j = 0; j < params->exprs.size(); j++) {
+                if (dynamic_cast<IdentifierNode*>(params->exprs[j])->ident == sum->ident) {
+                    setError(makeError(lineNum, "Parallel For sums must be distinct from each other and the counter!"));
+                }
+            }
+            resolveIdent(sum);
+            params->addNode(new IdentifierNode(sum->ident, "IDENT", lineNum));
+        }
+        IdentifierNode *name = new IdentifierNode("ParallelFor", "IDENT", lineNum);
+        forNode->body = new SubNode(name, params, forNode->block, "SUB", lineNum);
+        resolveSub(forNode->body, true);
+    }
+
+    /// Declare every variable a statement assigns as a local of
+    /// currentSub. Lists indexed on the left of an assignment
+    /// are not assigned themselves so stay shared.
+    void declareAssigned(Node *node) {
+        if (node == NULL) {
+            return;
+        }
+        switch (node->type) {
+            case NODE_BLOCK: {
+                NodeList *stmts = dynamic_cast<BlockNode*>(node)->getStmts();
+                for (size_t i = 0; i < stmts->size(); i++) {
+                    declareAssigned((*stmts)[i]);
+                }
+                break;
+            }
+            case NODE_VAR_ASSIGN:
+                declareLocal(dynamic_cast<VarAssignNode*>(node)->ident);
+                break;
+            case NODE_VAR_DECL:
+                declareLocal(dynamic_cast<VarDeclNode*>(node)->ident);
+                break;
+            case NODE_IF:
+                declareAssigned(dynamic_cast<IfNode*>(node)->thenBranch);
+                declareAssigned(dynamic_cast<IfNode*>(node)->elseBranch);
+                break;
+            case NODE_WHILE:
+                declareAssigned(dynamic_cast<WhileNode*>(node)->block);
+                break;
+            case NODE_FOR:
+                declareLocal(dynamic_cast<ForNode*>(node)->ident);
+                declareAssigned(dynamic_cast<ForNode*>(node)->block);
+                break;
+            default:
+                break;
+        }
+    }
+
+    void declareLocal(Node *node) {
+        IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(node);
+        auto it = locals.find(identNode->ident);
+        if (it == locals.end()) {
+            it = locals.insert({identNode->ident, currentSub->numLocals++}).first;
+        }
+        identNode->slot = it->second;
+        identNode->local = true;
+    }
+
+    /// Bind a call to its Sub or Builtin. Statement calls
+    /// report a missing Sub, calls in expressions a missing
+    /// builtin.
+    void resolveCall(CallNode *call, bool statement) {
+        ExprListNode *args = dynamic_cast<ExprListNode*>(call->args);
+        resolveNode(args);
+        const char *name = dynamic_cast<IdentifierNode*>(call->ident)->ident;
+        size_t arity;
+        auto sub = subs.find(name);
+        if (sub != subs.end()) {
+            call->sub = sub->second;
+            arity = dynamic_cast<ExprListNode*>(sub->second->params)->exprs.size();
+        } else {
+            auto builtin = builtins.find(name);
+            if (builtin == builtins.end()) {
+                setError(makeError(call->lineNum, statement
+                    ? "Could not find sub with that identifier"
+                    : "Could not find builtin with that identifier"));
+                return;
+            }
+            call->builtin = builtin->second;
+            arity = builtin->second->arity;
+        }
+        if (args->exprs.size() != arity) {
+            std::string message = "Expected " + std::to_string(arity) +
+                " arguments when calling " + name + "!";
+            setError(makeError(call->lineNum, message.c_str()));
+        }
+    }
+
+    void setError(Value e) {
+        if (error.isNull()) {
+            error = e;
+        }
+    }
+
+    void resolveIdent(Node *node) {
+        IdentifierNode *identNode = dynamic_cast<IdentifierNode*>(node);
+        if (currentSub != NULL) {
+            auto local = locals.find(identNode->ident);
+            if (local != locals.end()) {
+                identNode->slot = local->second;
+                identNode->local = true;
+                return;
+            }
+        }
+        auto it = slots.find(identNode->ident);
+        if (it != slots.end()) {
+            identNode->slot = it->second;
+            return;
+        }
+        identNode->slot = globalNames.size();
+        slots[identNode->ident] = identNode->slot;
+        globalNames.push_back(identNode->ident);
+    }
+};
+
+/// Resolve every variable in the program to a global
+/// or Sub frame slot and size the globals array to match.
+/// Returns an error for an unknown Sub or builtin, a wrong
+/// number of arguments or a Return outside of a Sub.
+Value resolve(Interpreter *interp, ProgramNode *prog) {
+    Resolver resolver(interp);
+    resolver.collectSubs(prog);
+    resolver.resolveNode(prog);
+    interp->globals.resize(interp->globalNames.size());
+    return resolver.takeError();
+}
+
+/// Resolve a standalone expression, such as a breakpoint condition,
+/// against the same slots as the program.
+Value resolveExpr(Interpreter *interp, Node *expr) {
+    Resolver resolver(interp);
+    resolver.resolveNode(expr);
+    interp->globals.resize(interp->globalNames.size());
+    return resolver.takeError();
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "node.hpp"
+#include "value.hpp"
+
+class Interpreter;
+
+Value resolve(Interpreter *interp, ProgramNode *prog);
+Value resolveExpr(Interpreter *interp, Node *expr);
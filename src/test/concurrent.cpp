@@ -0,0 +1,67 @@
+#include "../interpreter.hpp"
+#include "../output.hpp"
+#include <atomic>
+#include <iostream>
+#include <string.h>
+#include <thread>
+
+/// Runs every program named on the command line at once, each in an
+/// Interpreter of its own on a thread of its own, then writes the
+/// symbol table of each in command line order. Lines printed by the
+/// programs themselves may come out in any order, so the programs
+/// tested this way only assign variables.
+/// Call in format ./concurrent [--tree] a.sb b.sb ...
+int main(int argc, char *argv[]) {
+    initOutput();
+    bool treeWalk = false;
+    std::vector<const char*> paths;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--tree") == 0) {
+            treeWalk = true;
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    std::vector<Interpreter*> interps;
+    for (size_t i = 0; i < paths.size(); i++) {
+        Interpreter *interp = new Interpreter();
+        interp->treeWalk = treeWalk;
+        interp->sourcePath = paths[i];
+        interps.push_back(interp);
+    }
+
+    // Every thread waits for the others before parsing, so the
+    // parses overlap as well as the runs
+    std::atomic<size_t> waiting(paths.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < paths.size(); i++) {
+        threads.emplace_back([&, i]() {
+            FILE *file = fopen(paths[i], "r");
+            waiting--;
+            while (waiting > 0) {
+                std::this_thread::yield();
+            }
+            if (file == NULL) {
+                return;
+            }
+            bool parsed = interps[i]->parse(file);
+            fclose(file);
+            if (parsed && interps[i]->prepare().isNull()) {
+                interps[i]->run();
+            }
+        });
+    }
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        const char *name = strrchr(paths[i], '/');
+        std::cout << (name == NULL ? paths[i] : name + 1) << std::endl;
+        interps[i]->writeSymbolTable();
+        delete interps[i];
+    }
+    flushOutput();
+    return 0;
+}
@@ -1,11 +1,64 @@
 import subprocess
 import os
+import re
+import shutil
+import tempfile
 
 BASE_PATH = "/".join(__file__.split("/")[:-1])
 SNIPPETS_PATH = BASE_PATH + "/snippets/"
 OUTPUTS_PATH = BASE_PATH + "/outputs/"
 INTERPRETER_PATH = BASE_PATH + "/../../build/sb"
-TEST_FILES = os.listdir(SNIPPETS_PATH)
+CONCURRENT_PATH = BASE_PATH + "/../../build/concurrent"
+CONCURRENT_SNIPPETS_PATH = BASE_PATH + "/concurrent/"
+CONCURRENT = ["primes.sb", "words.sb"]
+# Snippets too large to keep in the repo, written out before running
+GENERATED = {
+    "long_expression.sb": "a = 1\n"
+        + "Print(" + " + ".join(["1"] * 100000) + ")\n"
+        + "Print(" + " + ".join(["a"] * 100000) + ")\n"
+        + "Print(len(\"\"" + " + \"ab\"" * 50000 + "))\n"
+        + "Print(" + " - ".join(["a"] * 50000) + " + \"s\")\n"
+}
+GENERATED_PATH = tempfile.mkdtemp() + "/"
+for name, source in GENERATED.items():
+    with open(GENERATED_PATH + name, "w") as f:
+        f.write(source)
+TEST_FILES = os.listdir(SNIPPETS_PATH) + list(GENERATED)
+# Every snippet is run on the VM and on the tree walker
+MODES = ["", " --tree"]
+# Extra flags passed to specific snippets
+FLAGS = {"gc.sb": " --gc-stats", "symbols.sb": " --sym", "dump_ast.sb": " --dump-ast",
+         "tail_call.sb": " --max-depth 100", "parallel_for.sb": " --threads 4",
+         "parallel_append.sb": " --threads 8", "parallel_map.sb": " --threads 8",
+         "parallel_slice.sb": " --threads 8", "parallel_alias.sb": " --threads 8",
+         "parallel_file.sb": " --threads 8", "fractional_for.sb": " --threads 4",
+         "profile.sb": " --profile"}
+
+def normalise_profile(output, path):
+    """Timings change from run to run, so drop the ms columns of the
+    --profile tables and sort their rows by line and by Sub name. The
+    folded stacks must be written beside the source, only their names
+    are kept."""
+    lines = output.split("\n")
+    start = lines.index("-- Profile Start --")
+    end = lines.index("-- Profile End --")
+    tables = [[]]
+    for line in lines[start + 1:end]:
+        if line == "":
+            tables.append([])
+        elif line.startswith("Folded stacks written to "):
+            assert line == "Folded stacks written to " + path + ".folded"
+        else:
+            line = re.sub(r" +excl ms +incl ms", "", line)
+            tables[-1].append(re.sub(r" +\d+\.\d+ +\d+\.\d+", "", line, count=1))
+    rows = []
+    for table in tables:
+        key = (lambda r: int(r.split()[0])) if "line" in table[0] else (lambda r: r.split()[0])
+        rows += table[:1] + sorted(table[1:], key=key) + [""]
+    with open(path + ".folded", "r") as f:
+        stacks = sorted(line.rsplit(" ", 1)[0] for line in f)
+    os.remove(path + ".folded")
+    return "\n".join(lines[:start + 1] + rows + stacks + lines[end:])
 
 class bcolors:
     HEADER = '\033[95m'
@@ -18,29 +71,51 @@ class bcolors:
     BOLD = '\033[1m'
     UNDERLINE = '\033[4m'
 
-for file in TEST_FILES:
-    expected_output = ""
-    with open(OUTPUTS_PATH + file, "r") as f:
-        expected_output = f.read()
-    cmd = INTERPRETER_PATH + " " + SNIPPETS_PATH + file
-    result = subprocess.run(cmd, shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
-    output = result.stderr.decode("utf-8")
-    output += result.stdout.decode("utf-8")
-    try:
-        assert output == expected_output
-        print(f" - Start Test for {file} - ")
+def check(file, mode, output, expected_output):
+    if output == expected_output:
+        print(f" - Start Test for {file}{mode} - ")
         print(f" --- ACTUAL OUTPUT --- ")
         print(output)
         print(f" --- EXPECTED OUTPUT ---")
         print(expected_output)
         print(" --------------------- ")
-        print(f"{bcolors.OKGREEN}Passed{bcolors.ENDC} assertion for file {file}")
-    except Exception as e:
+        print(f"{bcolors.OKGREEN}Passed{bcolors.ENDC} assertion for file {file}{mode}")
+    else:
         print(
             f"{bcolors.FAIL}Failed{bcolors.ENDC} assertion for file "
-            + file
+            + file + mode
             + "\nEXPECTED OUTPUT:\n"
             + expected_output
             + "\nACTUAL OUTPUT:\n"
             + output
         )
+
+for file in TEST_FILES:
+    expected_output = ""
+    with open(OUTPUTS_PATH + file, "r") as f:
+        expected_output = f.read()
+    for mode in MODES:
+        path = (GENERATED_PATH if file in GENERATED else SNIPPETS_PATH) + file
+        cmd = INTERPRETER_PATH + " " + path + FLAGS.get(file, "") + mode
+        result = subprocess.run(cmd, shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        output = result.stderr.decode("utf-8")
+        output += result.stdout.decode("utf-8")
+        try:
+            if "--profile" in FLAGS.get(file, ""):
+                output = normalise_profile(output, path)
+        except Exception as e:
+            output += f"\n{type(e).__name__}: {e}"
+        check(file, mode, output, expected_output)
+
+# Programs run at once by build/concurrent, each in an Interpreter of
+# its own on a thread of its own, every program twice
+with open(OUTPUTS_PATH + "concurrent.txt", "r") as f:
+    expected_output = f.read()
+for mode in MODES:
+    cmd = CONCURRENT_PATH + mode + "".join(" " + CONCURRENT_SNIPPETS_PATH + file for file in CONCURRENT * 2)
+    result = subprocess.run(cmd, shell=True, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    output = result.stderr.decode("utf-8")
+    output += result.stdout.decode("utf-8")
+    check("concurrent", mode, output, expected_output)
+
+shutil.rmtree(GENERATED_PATH)
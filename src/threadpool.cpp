@@ -0,0 +1,106 @@
+#include "threadpool.hpp"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Fixed set of threads handed one job at a time. Each job
+/// bumps the generation, threads numbered at most the job's
+/// worker count run it and the caller waits for them all.
+class ThreadPool {
+public:
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < threads.size(); i++) {
+            threads[i].join();
+        }
+    }
+
+    /// Run work on workers threads, unless another job holds the
+    /// pool. Returns false without running anything if one does.
+    bool tryRun(int workers, const std::function<void(int)> &work) {
+        std::unique_lock<std::mutex> claim(busy, std::try_to_lock);
+        if (!claim.owns_lock()) {
+            return false;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        while ((int)threads.size() < workers - 1) {
+            // New threads start at the current generation so they
+            // only pick up the job about to be posted
+            threads.emplace_back(&ThreadPool::loop, this, (int)threads.size() + 1, generation);
+        }
+        job = &work;
+        jobWorkers = workers;
+        remaining = workers - 1;
+        generation++;
+        lock.unlock();
+        wake.notify_all();
+
+        work(0);
+
+        lock.lock();
+        done.wait(lock, [this] { return remaining == 0; });
+        job = NULL;
+        return true;
+    }
+
+private:
+    std::vector<std::thread> threads;
+    std::mutex busy;  // Held by the caller of the running job
+    std::mutex mutex;
+    std::condition_variable wake; // A job was posted or the pool is stopping
+    std::condition_variable done; // The last thread finished its part of a job
+    const std::function<void(int)> *job = NULL;
+    int jobWorkers = 0;
+    int remaining = 0;
+    size_t generation = 0;
+    bool stopping = false;
+
+    void loop(int index, size_t seen) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+            if (index >= jobWorkers) {
+                continue;
+            }
+            const std::function<void(int)> *work = job;
+            lock.unlock();
+            (*work)(index);
+            lock.lock();
+            if (--remaining == 0) {
+                done.notify_one();
+            }
+        }
+    }
+};
+
+static ThreadPool pool;
+
+/// Threads a Parallel For spreads its iterations over, requested
+/// is --threads or 0 for one per core.
+int threadCount(int requested) {
+    if (requested > 0) {
+        return requested;
+    }
+    int cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+/// Call work once with each worker index from 0 to workers - 1,
+/// all but the first on pool threads, and return when every call has.
+/// While another loop has the pool only work(0) is called, so work
+/// must keep taking iterations until none are left.
+void runOnThreads(int workers, const std::function<void(int)> &work) {
+    if (workers <= 1 || !pool.tryRun(workers, work)) {
+        work(0);
+    }
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <functional>
+
+// Threads running the iterations of a Parallel For. They are
+// started the first time a loop needs them and then wait for
+// the next loop, the calling thread always takes part as worker 0.
+// One loop uses them at a time, a loop started by another
+// Interpreter meanwhile runs on its calling thread alone.
+int threadCount(int requested);
+void runOnThreads(int workers, const std::function<void(int)> &work);
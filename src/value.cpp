@@ -1,10 +1,196 @@
 #include "value.hpp"
 
+/// FNV-1a hash over a run of bytes.
+static uint32_t fnv(const char *str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+thread_local InternPool *internPool = NULL;
+
+/// Create a string value, strings short enough are
+/// packed into the Value itself.
+Value Value::string(const char *string, size_t length) {
+    if (length <= SMALL_STRING_MAX && memchr(string, '\0', length) == NULL) {
+        uint64_t payload = 0;
+        for (size_t i = 0; i < length; i++) {
+            payload |= (uint64_t)(unsigned char)string[i] << (8 * i);
+        }
+        Value v;
+        v.bits = box(TAG_SMALL_STRING, payload);
+        return v;
+    }
+    return Value::object(new StringValue(string, length));
+}
+
+Value Value::string(const char *string) {
+    return Value::string(string, strlen(string));
+}
+
+/// Return the pooled copy of a string, adding it on first use.
+/// The characters stay valid until the pool is cleared.
+StringValue *intern(const char *string, size_t length) {
+    auto it = internPool->find(std::string_view(string, length));
+    if (it != internPool->end()) {
+        return it->second.as<StringValue>();
+    }
+    StringValue *s = new StringValue(string, length);
+    s->interned = true;
+    s->hash = fnv(string, length);
+    internPool->emplace(std::string_view(s->chars(), length), Value::object(s));
+    return s;
+}
+
+/// Create a string value sharing the pooled copy, equal
+/// interned strings are then the same heap object.
+Value internString(const char *string, size_t length) {
+    if (length <= Value::SMALL_STRING_MAX && memchr(string, '\0', length) == NULL) {
+        return Value::string(string, length);
+    }
+    return Value::object(intern(string, length));
+}
+
+/// Convert any value to its printable form.
+std::string Value::stringify() const {
+    switch (type()) {
+        case VAL_NUMBER:
+            return std::to_string(asNumber());
+        case VAL_BOOL:
+            return asBool() ? "True" : "False";
+        case VAL_STRING: {
+            StringRef s(*this);
+            return std::string(s.data(), s.size());
+        }
+        case VAL_NULL:
+            return "";
+        default:
+            return asObject()->stringify();
+    }
+}
+
+/// Helper hash function for map keys. Strings hash their
+/// contents, lists and maps hash by identity.
+uint32_t hashValue(const Value &v) {
+    switch (v.type()) {
+        case VAL_NUMBER: {
+            double d = v.asNumber();
+            if (d == 0) {
+                d = 0; // -0 and 0 are the same key
+            }
+            uint64_t bits;
+            memcpy(&bits, &d, sizeof(bits));
+            bits ^= bits >> 33;
+            bits *= 0xFF51AFD7ED558CCDULL;
+            bits ^= bits >> 33;
+            return (uint32_t)bits;
+        }
+        case VAL_BOOL:
+            return v.asBool() ? 1 : 0;
+        case VAL_STRING: {
+            if (isInterned(v)) {
+                return v.as<StringValue>()->hash;
+            }
+            StringRef s(v);
+            return fnv(s.data(), s.size());
+        }
+        case VAL_NULL:
+            return 0;
+        default: {
+            uint64_t bits = (uint64_t)(uintptr_t)v.asObject();
+            return (uint32_t)(bits ^ (bits >> 32));
+        }
+    }
+}
+
+/// Helper to check two map keys are the same key.
+bool keysEqual(const Value &lhs, const Value &rhs) {
+    if (lhs.bits == rhs.bits) {
+        // Same number, boolean, small string or heap object
+        return true;
+    }
+    ValueType type = lhs.type();
+    if (type != rhs.type()) {
+        return false;
+    }
+    switch (type) {
+        case VAL_NUMBER:
+            return lhs.asNumber() == rhs.asNumber();
+        case VAL_STRING: {
+            if (isInterned(lhs) && isInterned(rhs)) {
+                return false; // Distinct pool entries
+            }
+            StringRef l(lhs);
+            StringRef r(rhs);
+            return l.size() == r.size() && memcmp(l.data(), r.data(), l.size()) == 0;
+        }
+        default:
+            return false;
+    }
+}
+
+/// Helper to build an error value.
+Value makeError(int lineNum, const char *error) {
+    return Value::object(new ErrorValue(lineNum, error));
+}
+
 /// Helper to check if a value is an error.
-bool isError(Value *v) {
-    if (v != NULL && v->type == VAL_ERROR) {
+bool isError(const Value &v) {
+    if (v.isObject() && v.asObject()->type == VAL_ERROR) {
         return true;
     }
 
     return false;
-}
\ No newline at end of file
+}
+
+/// Mark every list, map and file reachable from v as shared by
+/// Parallel For iterations, or no longer when shared is false.
+/// Walks with a stack of its own as lists may nest deeply or
+/// contain themselves.
+void shareValue(const Value &v, bool shared) {
+    std::vector<Value> pending(1, v);
+    while (!pending.empty()) {
+        Value next = pending.back();
+        pending.pop_back();
+        if (!next.isObject()) {
+            continue;
+        }
+        HeapValue *object = next.asObject();
+        if (object->type == VAL_LIST) {
+            ListValue *list = next.as<ListValue>();
+            if (list->shared == shared) {
+                continue;
+            }
+            list->share(shared);
+            for (size_t i = 0; i < list->size(); i++) {
+                pending.push_back((*list)[i]);
+            }
+        } else if (object->type == VAL_MAP) {
+            MapValue *map = next.as<MapValue>();
+            if (map->shared == shared) {
+                continue;
+            }
+            map->shared = shared;
+            for (size_t i = 0; i < map->entries.size(); i++) {
+                pending.push_back(map->entries[i].key);
+                pending.push_back(map->entries[i].value);
+            }
+        } else if (object->type == VAL_FILE) {
+            next.as<FileValue>()->shared = shared;
+        }
+    }
+}
+
+/// Helper to write the heap value counters, shows whether
+/// memory stayed flat over the run.
+void writeGCStats(std::ostream &out) {
+    out << "-- GC Stats Start --" << std::endl;
+    out << "allocated: " << gcStats.allocated << std::endl;
+    out << "freed: " << gcStats.freed << std::endl;
+    out << "live: " << gcStats.live << std::endl;
+    out << "peak live: " << gcStats.peakLive << std::endl;
+    out << "-- GC Stats End --" << std::endl;
+}
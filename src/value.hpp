@@ -2,7 +2,13 @@
 
 #include <cstring>
 #include <cstdlib>
+#include <cstdint>
+#include <cstdio>
+#include <sys/mman.h>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <map>
 #include <algorithm>
@@ -11,270 +17,791 @@
 /// so that value types can be identified prior
 /// to casting.
 enum ValueType {
+    VAL_NULL,
     VAL_NUMBER,
     VAL_BOOL,
     VAL_STRING,
     VAL_LIST,
     VAL_MAP,
+    VAL_FILE,
     VAL_ERROR
 };
 
-/// Helper hash function to hash values to an integer,
-/// (used for maps).
-static unsigned int fnv(const char *str) {
-    const size_t length = strlen(str) + 1;
-    unsigned int hash = 2166136261u;
-    for (size_t i = 0; i < length; ++i) {
-        hash ^= *str++;
-        hash *= 16777619u;
-    }
-    return hash;
-}
-
-/// Abstract value class to be inheritted from.
-/// Represents a value in Small Basic.
+class HeapValue;
+
+/// A Small Basic value packed into a single 64 bit word (NaN boxing).
+/// Numbers are stored as plain doubles. Everything else lives in the
+/// negative quiet NaN space: the top 13 bits are set, the next 3 bits
+/// hold a tag and the low 48 bits hold the payload. Booleans and strings
+/// of up to 6 bytes are stored inline, only lists, maps, errors and
+/// longer strings point at a HeapValue.
+///
+/// Heap values are reference counted, every Value pointing at one
+/// owns a reference which is dropped when it is overwritten or destroyed.
 class Value {
 public:
-    ValueType type;
+    static const uint64_t BOX_MASK = 0xFFF8000000000000ULL;
+    static const uint64_t TAG_MASK = 0x0007000000000000ULL;
+    static const uint64_t PAYLOAD_MASK = 0x0000FFFFFFFFFFFFULL;
+    static const uint64_t CANONICAL_NAN = 0x7FF8000000000000ULL;
+    static const int TAG_SHIFT = 48;
+    static const size_t SMALL_STRING_MAX = 6;
 
-    Value(ValueType type) {
-        this->type = type;
+    enum Tag {
+        TAG_NULL = 1,
+        TAG_BOOL = 2,
+        TAG_SMALL_STRING = 3,
+        TAG_OBJECT = 4
+    };
+
+    uint64_t bits;
+
+    /// Default constructed values are NULL (no value).
+    Value() : bits(box(TAG_NULL, 0)) {}
+
+    Value(const Value &other) : bits(other.bits) {
+        retain();
     }
 
-    virtual void f() {}
+    Value(Value &&other) noexcept : bits(other.bits) {
+        other.bits = box(TAG_NULL, 0);
+    }
 
-    virtual const char *stringify() const { return ""; }
+    Value &operator=(const Value &other) {
+        other.retain();
+        release();
+        bits = other.bits;
+        return *this;
+    }
 
-    virtual unsigned int hashKey() const {
-        return 0;
+    Value &operator=(Value &&other) noexcept {
+        if (this != &other) {
+            release();
+            bits = other.bits;
+            other.bits = box(TAG_NULL, 0);
+        }
+        return *this;
     }
 
-    virtual Value *copy() const {
-        return NULL;
+    ~Value() {
+        release();
     }
 
-    inline bool operator< (const Value& rhs) const {
-        return this->hashKey() < rhs.hashKey();
+    static Value null() {
+        return Value();
     }
 
-};
+    static Value number(double number) {
+        Value v;
+        if (number != number) {
+            // Real NaNs must never be mistaken for a boxed value
+            v.bits = CANONICAL_NAN;
+        } else {
+            memcpy(&v.bits, &number, sizeof(double));
+        }
+        return v;
+    }
 
-/// Class representing a number value in Small Basic.
-/// Returns the raw double number.
-class NumberValue : public Value {
-public:
-    double number;
+    static Value boolean(bool boolean) {
+        Value v;
+        v.bits = box(TAG_BOOL, boolean ? 1 : 0);
+        return v;
+    }
 
-    NumberValue(double number) : Value(VAL_NUMBER) {
-        this->number = number;
+    /// Wrap a heap value, the new Value takes a reference to it.
+    static Value object(HeapValue *object) {
+        Value v;
+        v.bits = box(TAG_OBJECT, (uint64_t)(uintptr_t)object);
+        v.retain();
+        return v;
     }
 
-    const char *stringify() const override {
-        std::string t = std::to_string(number);
-        char *str = (char *)malloc(t.size() + 1);
-        strcpy(str, t.c_str());
-        return str;
+    static Value string(const char *string);
+    static Value string(const char *string, size_t length);
+
+    inline bool isNumber() const { return (bits & BOX_MASK) != BOX_MASK; }
+    inline bool isNull() const { return bits == box(TAG_NULL, 0); }
+    inline bool isBool() const { return !isNumber() && tag() == TAG_BOOL; }
+    inline bool isSmallString() const { return !isNumber() && tag() == TAG_SMALL_STRING; }
+    inline bool isObject() const { return !isNumber() && tag() == TAG_OBJECT; }
+
+    inline double asNumber() const {
+        double number;
+        memcpy(&number, &bits, sizeof(double));
+        return number;
     }
 
-    virtual Value *copy() const {
-        return new NumberValue(this->number);
+    inline bool asBool() const { return (bits & 1) != 0; }
+
+    inline HeapValue *asObject() const {
+        return (HeapValue *)(uintptr_t)(bits & PAYLOAD_MASK);
     }
 
-    unsigned int hashKey() const override {
-        return fnv(this->stringify());
+    /// Cast the heap object to the given HeapValue subclass,
+    /// the caller must have checked type() first.
+    template <class T>
+    inline T *as() const { return static_cast<T*>(asObject()); }
+
+    ValueType type() const;
+    bool isString() const { return type() == VAL_STRING; }
+    std::string stringify() const;
+
+private:
+    static inline uint64_t box(uint64_t tag, uint64_t payload) {
+        return BOX_MASK | (tag << TAG_SHIFT) | (payload & PAYLOAD_MASK);
     }
+
+    inline uint64_t tag() const { return (bits & TAG_MASK) >> TAG_SHIFT; }
+
+    inline void retain() const;
+    inline void release();
+};
+
+/// Counters describing heap value allocation, reported by --gc-stats.
+/// Live counts are signed as a thread may free values another made.
+struct GCStats {
+    size_t allocated = 0;
+    size_t freed = 0;
+    long live = 0;
+    long peakLive = 0;
 };
 
-/// Class representing a boolean value in Small Basic.
-/// Stores the raw bool value.
-class BoolValue : public Value {
+// Counted per thread so separate interpreters never share them,
+// a Parallel For adds its workers' counts to the thread running it.
+inline thread_local GCStats gcStats;
+
+// Set on each thread running Parallel For iterations while they
+// run. Reference counts are then changed with atomic instructions,
+// single threaded runs pay one branch.
+inline thread_local bool threadsActive = false;
+
+/// Add one to a counter other threads may change, returns the new count.
+template <class T>
+inline T sharedIncrement(T &counter) {
+    if (__builtin_expect(threadsActive, 0)) {
+        return __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    }
+    return ++counter;
+}
+
+/// Take one from a counter other threads may change, returns the
+/// new count. Orders earlier writes before whoever sees it reach 0.
+template <class T>
+inline T sharedDecrement(T &counter) {
+    if (__builtin_expect(threadsActive, 0)) {
+        return __atomic_sub_fetch(&counter, 1, __ATOMIC_ACQ_REL);
+    }
+    return --counter;
+}
+
+/// Abstract class for values that live on the heap.
+/// Referenced from a Value word.
+class HeapValue {
 public:
-    bool boolean;
+    ValueType type;
+    uint32_t refCount; // Number of Values referencing this object
 
-    BoolValue(bool boolean) : Value(VAL_BOOL) {
-        this->boolean = boolean;
+    HeapValue(ValueType type) {
+        this->type = type;
+        this->refCount = 0;
+        gcStats.allocated++;
+        if (++gcStats.live > gcStats.peakLive) {
+            gcStats.peakLive = gcStats.live;
+        }
+    }
+
+    virtual ~HeapValue() {
+        gcStats.freed++;
+        gcStats.live--;
+    }
+
+    virtual std::string stringify() const { return ""; }
+};
+
+inline void Value::retain() const {
+    if (isObject()) {
+        sharedIncrement(asObject()->refCount);
+    }
+}
+
+inline void Value::release() {
+    if (isObject()) {
+        HeapValue *object = asObject();
+        if (sharedDecrement(object->refCount) == 0) {
+            delete object;
+        }
     }
+}
 
-    virtual Value *copy() const {
-        return new BoolValue(this->boolean);
+/// Returns the type of the value, looking through to
+/// the heap object when boxed.
+inline ValueType Value::type() const {
+    if (isNumber()) {
+        return VAL_NUMBER;
+    }
+    switch (tag()) {
+        case TAG_BOOL:
+            return VAL_BOOL;
+        case TAG_SMALL_STRING:
+            return VAL_STRING;
+        case TAG_OBJECT:
+            return asObject()->type;
+        default:
+            return VAL_NULL;
     }
+}
 
-    const char *stringify() const override {
-        if (boolean) {
-            return "True";
+/// Growable character storage shared by string values. Each
+/// string value is a view of the first length bytes, so the value
+/// ending at used can append in place without disturbing the
+/// shorter views of the same buffer. A mapped buffer is a read
+/// only file mapping sliced into views at any offset, which
+/// never append.
+struct StringBuffer {
+    char *data;
+    size_t used;     // End of the longest view
+    size_t capacity;
+    uint32_t refCount;
+    bool mapped;     // data comes from mmap rather than malloc
+};
+
+/// Drop a reference to a buffer, freeing or unmapping its
+/// characters with the last one.
+inline void releaseBuffer(StringBuffer *buffer) {
+    if (sharedDecrement(buffer->refCount) == 0) {
+        if (buffer->mapped) {
+            munmap(buffer->data, buffer->used);
         } else {
-            return "False";
+            free(buffer->data);
+        }
+        delete buffer;
+    }
+}
+
+/// Class representing a string too long to be stored inline
+/// in a Value. A view of length bytes of a StringBuffer from
+/// offset, which is only non zero in a mapped buffer.
+class StringValue : public HeapValue {
+public:
+    StringBuffer *buffer;
+    size_t offset;
+    size_t length;
+    bool interned; // Owned by the intern pool, equal only to itself
+    uint32_t hash; // Cached map key hash, set when interned
+
+    StringValue(const char *string, size_t length) : HeapValue(VAL_STRING) {
+        init(length);
+        memcpy(buffer->data, string, length);
+    }
+
+    /// Allocate an uninitialised string of the given length
+    /// for the caller to fill in.
+    StringValue(size_t length) : HeapValue(VAL_STRING) {
+        init(length);
+    }
+
+    /// View the first length bytes of another string's buffer.
+    StringValue(StringValue *other, size_t length) : HeapValue(VAL_STRING) {
+        this->interned = false;
+        this->hash = 0;
+        this->offset = other->offset;
+        this->length = length;
+        this->buffer = other->buffer;
+        sharedIncrement(this->buffer->refCount);
+    }
+
+    /// View length bytes from offset of a mapped buffer.
+    StringValue(StringBuffer *buffer, size_t offset, size_t length) : HeapValue(VAL_STRING) {
+        this->interned = false;
+        this->hash = 0;
+        this->offset = offset;
+        this->length = length;
+        this->buffer = buffer;
+        sharedIncrement(this->buffer->refCount);
+    }
+
+    char *chars() const {
+        return buffer->data + offset;
+    }
+
+    /// Whether this value ends where its buffer ends, so
+    /// appending in place leaves every other view unchanged.
+    /// Never while threads run, as two could append at once.
+    bool ownsTail() const {
+        return !threadsActive && !interned && !buffer->mapped && buffer->used == length;
+    }
+
+    /// Append in place, doubling the buffer when it is full.
+    /// Only valid when ownsTail().
+    void append(const char *string, size_t count) {
+        size_t needed = buffer->used + count + 1;
+        if (needed > buffer->capacity) {
+            size_t capacity = buffer->capacity * 2;
+            if (capacity < needed) {
+                capacity = needed;
+            }
+            buffer->data = (char *)realloc(buffer->data, capacity);
+            buffer->capacity = capacity;
         }
+        memcpy(buffer->data + buffer->used, string, count);
+        buffer->used += count;
+        buffer->data[buffer->used] = '\0';
+    }
+
+    std::string stringify() const override {
+        return std::string(chars(), length);
     }
 
-    unsigned int hashKey() const override {
-        if (boolean) {
-            return 1;
+    virtual ~StringValue() {
+        releaseBuffer(buffer);
+    }
+
+private:
+    void init(size_t length) {
+        this->interned = false;
+        this->hash = 0;
+        this->offset = 0;
+        this->length = length;
+        this->buffer = new StringBuffer();
+        this->buffer->data = (char *)malloc(length + 1);
+        this->buffer->data[length] = '\0';
+        this->buffer->used = length;
+        this->buffer->capacity = length + 1;
+        this->buffer->refCount = 1;
+    }
+};
+
+/// Helper to check if a string value is a heap string
+/// held by the intern pool.
+inline bool isInterned(const Value &v) {
+    return v.isObject() && v.asObject()->type == VAL_STRING && v.as<StringValue>()->interned;
+}
+
+// Strings stored once per program, keyed by their contents. Each
+// entry holds a reference so pooled strings outlive the AST.
+typedef std::unordered_map<std::string_view, Value> InternPool;
+
+// Pool intern adds to, each Interpreter points it at its own
+// on the thread parsing its program
+extern thread_local InternPool *internPool;
+
+StringValue *intern(const char *string, size_t length);
+Value internString(const char *string, size_t length);
+
+/// Borrowed view of the characters of a string value, not NUL
+/// terminated as heap strings may share a longer buffer. Small
+/// strings are unpacked into the view itself so it must not
+/// outlive the statement using it.
+class StringRef {
+public:
+    StringRef(const Value &v) {
+        if (v.isSmallString()) {
+            heap = NULL;
+            length = 0;
+            for (size_t i = 0; i < Value::SMALL_STRING_MAX; i++) {
+                char c = (char)((v.bits >> (8 * i)) & 0xFF);
+                small[i] = c;
+                if (c == '\0') {
+                    break;
+                }
+                length++;
+            }
+            small[length] = '\0';
         } else {
-            return 0;
+            StringValue *s = v.as<StringValue>();
+            heap = s->chars();
+            length = s->length;
         }
     }
+
+    const char *data() const { return heap != NULL ? heap : small; }
+    size_t size() const { return length; }
+
+private:
+    const char *heap;
+    char small[Value::SMALL_STRING_MAX + 2];
+    size_t length;
 };
 
-/// Class representing a string value in Small Basic.
-/// Stores the raw char* value.
-class StringValue : public Value {
+/// Elements shared by a list and the slices taken of it.
+struct ListStorage {
+    std::vector<Value> values;
+    uint32_t refCount;
+};
+
+/// Class representing a list in Small Basic.
+/// A view of count elements of a ListStorage from start. A slice
+/// shares the storage of its source until either is written,
+/// then the writer copies its elements to storage of its own.
+///
+/// Elements are NaN boxed words, so while every element is a
+/// number the storage is a contiguous array of doubles. boxed
+/// counts the elements that are not numbers, when it is 0 the
+/// elements can be read with asNumber without checking each.
+/// Elements must be changed through the methods below.
+class ListValue : public HeapValue {
 public:
-    char *string;
+    bool shared; // Reachable from globals while a Parallel For runs
 
-    StringValue(const char *string) : Value(VAL_STRING) {
-        this->string = (char *)malloc(strlen(string) + 1);
-        strcpy(this->string, string);
+    ListValue() : HeapValue(VAL_LIST) {
+        this->storage = new ListStorage();
+        this->storage->refCount = 1;
+        this->start = 0;
+        this->count = 0;
+        this->boxed = 0;
+        this->shared = false;
     }
 
-    virtual Value *copy() const {
-        return new StringValue(this->string);
+    /// View count elements of another list from start.
+    ListValue(ListValue *source, size_t start, size_t count) : HeapValue(VAL_LIST) {
+        this->storage = source->storage;
+        sharedIncrement(this->storage->refCount);
+        this->start = source->start + start;
+        this->count = count;
+        this->boxed = count == source->count ? source->boxed : UNCOUNTED;
+        this->shared = false;
     }
 
-    const char *stringify() const override {
-        // May have to strcpy
-        return string;
+    virtual ~ListValue() {
+        if (sharedDecrement(storage->refCount) == 0) {
+            delete storage;
+        }
     }
 
-    virtual ~StringValue() {
-        free(string);
+    size_t size() const {
+        return count;
     }
 
-    unsigned int hashKey() const override {
-        return fnv(string);
+    const Value &operator[](size_t i) const {
+        return storage->values[start + i];
     }
-};
 
-/// Class representing a list in Small Basic.
-/// Stores a vector of values.
-class ListValue : public Value {
-public:
-    std::vector<Value*> values;
-    ListValue() : Value(VAL_LIST) {
+    void addValue(const Value &v) {
+        own();
+        if (!v.isNumber()) {
+            boxed++;
+        }
+        storage->values.push_back(v);
+        count++;
+    }
+
+    /// Once a list has been share()d, Parallel For iterations may
+    /// set distinct elements at the same time, so storing a number
+    /// over a number leaves boxed untouched.
+    void setValue(size_t i, const Value &v) {
+        own();
+        bool wasNumber = storage->values[i].isNumber();
+        if (v.isNumber() != wasNumber) {
+            if (wasNumber) {
+                sharedIncrement(boxed);
+            } else {
+                sharedDecrement(boxed);
+            }
+        }
+        storage->values[i] = v;
+    }
+
+    void insertValue(size_t i, const Value &v) {
+        own();
+        if (!v.isNumber()) {
+            boxed++;
+        }
+        storage->values.insert(storage->values.begin() + i, v);
+        count++;
+    }
+
+    Value removeValue(size_t i) {
+        own();
+        Value v = storage->values[i];
+        storage->values.erase(storage->values.begin() + i);
+        count--;
+        boxed -= !v.isNumber();
+        return v;
+    }
 
+    void reserve(size_t capacity) {
+        own();
+        storage->values.reserve(capacity);
     }
 
-    void addValue(Value *v) {
-        values.push_back(v);
+    /// Mark the list as reachable from every Parallel For iteration,
+    /// or no longer. Iterations may only set elements of a shared
+    /// list, so it is given storage of its own and its boxed
+    /// elements are counted first to keep those writes from
+    /// copying or recounting.
+    void share(bool shared) {
+        own();
+        this->shared = shared;
     }
 
-    const char *stringify() const override {
+    /// Whether every element is a number.
+    bool isNumeric() const {
+        if (boxed == UNCOUNTED) {
+            boxed = countBoxed();
+        }
+        return boxed == 0;
+    }
+
+    /// The elements as doubles, only valid while isNumeric().
+    const double *numbers() const {
+        static_assert(sizeof(Value) == sizeof(double), "Values must be a single word");
+        return reinterpret_cast<const double*>(storage->values.data() + start);
+    }
+
+    /// Append count numbers for the caller to write through
+    /// the returned array.
+    double *appendNumbers(size_t count) {
+        own();
+        storage->values.resize(this->count + count, Value::number(0));
+        this->count += count;
+        return reinterpret_cast<double*>(storage->values.data() + this->count - count);
+    }
+
+    /// Whether a number index is in bounds, fractional
+    /// indexes are truncated.
+    bool inBounds(double index) const {
+        return index >= 0 && index < count;
+    }
+
+    std::string stringify() const override {
         std::string str = "[";
-        for (int i = 0; i < values.size(); i++) {
-            Value *v = values[i];
-            str = str + v->stringify();
-            if (i < values.size() - 1) {
-                str = str + ", ";
+        for (size_t i = 0; i < count; i++) {
+            str += (*this)[i].stringify();
+            if (i < count - 1) {
+                str += ", ";
             }
         }
         str += "]";
-        char *tmp = (char *)malloc(str.size() + 1);
-        strcpy(tmp, str.c_str());
-        return tmp;
+        return str;
     }
 
-    virtual ~ListValue() {
-        for (int i = 0; i < values.size(); i++) {
-            Value *v = values[i];
-            delete v;
+private:
+    static const size_t UNCOUNTED = (size_t)-1;
+
+    ListStorage *storage;
+    size_t start;
+    size_t count;
+    mutable size_t boxed; // Elements that are not numbers, UNCOUNTED for a new slice
+
+    size_t countBoxed() const {
+        size_t n = 0;
+        for (size_t i = 0; i < count; i++) {
+            n += !(*this)[i].isNumber();
         }
+        return n;
     }
 
-    unsigned int hashKey() const override {
-        return fnv(this->stringify());
+    /// Copy the elements to storage of this list's own before a
+    /// write when the storage is shared or holds more than them.
+    /// Only views of part of a storage are UNCOUNTED, so a list
+    /// already owning all of its storage has nothing to recount.
+    void own() {
+        if (storage->refCount == 1 && start == 0 && count == storage->values.size()) {
+            return;
+        }
+        ListStorage *copy = new ListStorage();
+        copy->refCount = 1;
+        copy->values.assign(storage->values.begin() + start, storage->values.begin() + start + count);
+        if (sharedDecrement(storage->refCount) == 0) {
+            delete storage;
+        }
+        storage = copy;
+        start = 0;
+        isNumeric();
     }
 };
 
-/// Helper struct used to define how to determine keys are
-/// equal for Value*
-struct ValueMap {
-    bool operator()(Value *lhs, Value *rhs) const {
-        return lhs->hashKey() < rhs->hashKey();
-    }
-};
+uint32_t hashValue(const Value &v);
+bool keysEqual(const Value &lhs, const Value &rhs);
 
-/// Class representing a map in SmallBasic
-/// Contains a C++ map of values.
-class MapValue : public Value {
+/// Class representing a map in SmallBasic.
+/// An open addressing hash table with linear probing, entries
+/// are kept in insertion order and the slot table holds indexes
+/// into them. Each entry caches the hash of its key.
+class MapValue : public HeapValue {
 public:
-    std::map<Value*, Value*, ValueMap> map;
+    struct Entry {
+        Value key;
+        Value value;
+        uint32_t hash;
+    };
 
-    MapValue() : Value(VAL_MAP) {}
+    std::vector<Entry> entries; // Insertion order
+    bool shared;                // Reachable from globals while a Parallel For runs
 
-    void addValue(Value *key, Value *val) {
-        map[key->copy()] = val->copy();
+    MapValue() : HeapValue(VAL_MAP) {
+        this->shared = false;
     }
 
-    void removeValue(Value *key) {
-        auto it = map.find(key);
-        map.erase(it);
+    /// Number of keys in the map.
+    size_t size() const {
+        return entries.size();
     }
 
-    Value *getValue(Value *key) {
-        return map[key];
+    void addValue(const Value &key, const Value &val) {
+        uint32_t hash = hashValue(key);
+        int32_t found = find(key, hash);
+        if (found != EMPTY) {
+            entries[found].value = val;
+            return;
+        }
+        if ((entries.size() + 1) * 4 > slots.size() * 3) {
+            rebuild();
+        }
+        insertSlot(hash, entries.size());
+        entries.push_back({key, val, hash});
     }
 
-    const char *stringify() const override {
-        if (map.size() == 0) {
-            return "{}";
+    /// Look up a key, returns a NULL value when missing.
+    Value getValue(const Value &key) const {
+        int32_t found = find(key, hashValue(key));
+        if (found == EMPTY) {
+            return Value::null();
         }
+        return entries[found].value;
+    }
+
+    std::string stringify() const override {
         std::string str = "{";
-        auto endIt = map.end();
-        endIt--; // second last ele
-        
-        for (auto it = map.begin(); it != map.end(); it++) {
-            Value *key = it->first;
-            Value *val = it->second;
-            str = str + key->stringify() + ": " + val->stringify();
-            if (it != endIt) {
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (i > 0) {
                 str += ", ";
             }
+            str += entries[i].key.stringify() + ": " + entries[i].value.stringify();
         }
         str += "}";
-        char *tmp = (char *)malloc(str.size() + 1);
-        strcpy(tmp, str.c_str());
-        return tmp;
+        return str;
+    }
+
+private:
+    enum : int32_t {
+        EMPTY = -1
+    };
+
+    std::vector<int32_t> slots; // Power of two sized, EMPTY or an entry index
+
+    /// Returns the index of the entry holding key or EMPTY.
+    int32_t find(const Value &key, uint32_t hash) const {
+        if (slots.empty()) {
+            return EMPTY;
+        }
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; slots[i] != EMPTY; i = (i + 1) & mask) {
+            int32_t e = slots[i];
+            if (entries[e].hash == hash && keysEqual(entries[e].key, key)) {
+                return e;
+            }
+        }
+        return EMPTY;
+    }
+
+    void insertSlot(uint32_t hash, size_t entry) {
+        size_t mask = slots.size() - 1;
+        size_t i = hash & mask;
+        while (slots[i] != EMPTY) {
+            i = (i + 1) & mask;
+        }
+        slots[i] = (int32_t)entry;
+    }
+
+    /// Rehash into a table at most half full after the next insert.
+    void rebuild() {
+        size_t capacity = 8;
+        while (capacity < (entries.size() + 1) * 2) {
+            capacity *= 2;
+        }
+        slots.assign(capacity, EMPTY);
+        for (size_t i = 0; i < entries.size(); i++) {
+            insertSlot(entries[i].hash, i);
+        }
+    }
+};
+
+/// Class representing a file opened for reading one line at a
+/// time. Lines are read into the buffer of the current line
+/// string, which is reused once the script no longer holds it,
+/// so streaming a file allocates nothing per line.
+class FileValue : public HeapValue {
+public:
+    FILE *file; // NULL once the end has been reached
+    Value line; // Current line, NULL before the first read
+    bool shared; // Reachable from globals while a Parallel For runs
+
+    FileValue(FILE *file) : HeapValue(VAL_FILE) {
+        this->file = file;
+        this->shared = false;
+    }
+
+    /// Read the next line without its newline, returns false
+    /// and closes the file at the end.
+    bool next() {
+        if (file == NULL) {
+            return false;
+        }
+        StringValue *s = reusableLine();
+        if (s == NULL) {
+            s = new StringValue((size_t)0);
+            line = Value::object(s);
+        }
+        ssize_t read = getline(&s->buffer->data, &s->buffer->capacity, file);
+        if (read < 0) {
+            fclose(file);
+            file = NULL;
+            line = Value::null();
+            return false;
+        }
+        if (read > 0 && s->buffer->data[read - 1] == '\n') {
+            s->buffer->data[--read] = '\0';
+        }
+        s->length = read;
+        s->buffer->used = read;
+        return true;
+    }
+
+    std::string stringify() const override {
+        return "<file>";
     }
 
-    virtual ~MapValue() {
-        for (auto it = map.begin(); it != map.end(); it++) {
-            Value *key = it->first;
-            Value *val = it->second;
-            delete key;
-            delete val;
+    virtual ~FileValue() {
+        if (file != NULL) {
+            fclose(file);
         }
     }
 
-    unsigned int hashKey() const override {
-        return fnv(this->stringify());
+private:
+    /// The current line when nothing but this file references
+    /// it or its buffer, otherwise NULL.
+    StringValue *reusableLine() {
+        if (!line.isObject() || line.asObject()->refCount != 1) {
+            return NULL;
+        }
+        StringValue *s = line.as<StringValue>();
+        return s->buffer->refCount == 1 ? s : NULL;
     }
 };
 
-class ErrorValue : public Value {
+class ErrorValue : public HeapValue {
 public:
     char *error;
     int lineNum;
 
-    ErrorValue(int lineNum, char *error) : Value(VAL_ERROR) {
+    ErrorValue(int lineNum, const char *error) : HeapValue(VAL_ERROR) {
         this->lineNum = lineNum;
         this->error = (char *)malloc(strlen(error) + 1);
         strcpy(this->error, error);
     }
 
-    const char *stringify() const override {
+    std::string stringify() const override {
         std::string errPrelude = "ERROR AT LINE " + std::to_string(this->lineNum);
-        std::string err = errPrelude + ": " + this->error;
-        const char *str = err.c_str();
-        return str;
+        return errPrelude + ": " + this->error;
     }
 
     virtual ~ErrorValue() {
         free(error);
     }
-
-    unsigned int hashKey() const override {
-        return fnv(this->stringify());
-    }
 };
 
-bool isError(Value *v);
\ No newline at end of file
+Value makeError(int lineNum, const char *error);
+bool isError(const Value &v);
+void shareValue(const Value &v, bool shared);
+void writeGCStats(std::ostream &out);
@@ -0,0 +1,427 @@
+#include "vm.hpp"
+#include "compiler.hpp"
+#include "evaluator.hpp"
+#include "interpreter.hpp"
+#include "output.hpp"
+#include "builtin.hpp"
+#include "threadpool.hpp"
+
+#include <atomic>
+#include <mutex>
+
+static Value runParallelFor(Interpreter *interp, Bytecode *program, const ParallelLoop &loop, const Value *R, int lineNum);
+
+/// Helper to check both operands are numbers so the
+/// arithmetic fast paths can be taken.
+static inline bool bothNumbers(const Value &l, const Value &r) {
+    return l.isNumber() && r.isNumber();
+}
+
+VM::VM(Interpreter *interp, Bytecode *program, bool worker) {
+    this->interp = interp;
+    this->program = program;
+    this->worker = worker;
+}
+
+void VM::ensureRegisters(size_t count) {
+    if (registers.size() < count) {
+        registers.resize(count);
+    }
+}
+
+/// Run the program from the top level chunk until it returns
+/// or an error occurs. Returns the ErrorValue on failure.
+Value VM::run() {
+    return call(0, NULL, 0);
+}
+
+/// Run chunk index in a fresh bottom frame whose first argc
+/// registers hold args, until it returns or an error occurs.
+/// Returns the ErrorValue on failure.
+Value VM::call(uint32_t index, const Value *args, int argc) {
+    Chunk *chunk = program->chunks[index];
+    frames.clear();
+    frames.push_back({chunk, 0, 0});
+    ensureRegisters(chunk->numRegisters);
+    for (int i = 0; i < chunk->numRegisters; i++) {
+        registers[i] = i < argc ? args[i] : Value::null();
+    }
+    const Instruction *code = chunk->code.data();
+    Value *R = registers.data();
+    size_t pc = 0;
+    std::vector<Value> &globals = interp->globals;
+
+// Line of the instruction currently executing
+#define LINE() (chunk->lines[pc - 1])
+
+// Arithmetic with an unboxed fast path for two numbers
+#define ARITH_OP(opChar, makeValue) {                               \
+        const Value &l = R[ins.b];                                  \
+        const Value &r = R[ins.c];                                  \
+        if (bothNumbers(l, r)) {                                    \
+            double x = l.asNumber();                                \
+            double y = r.asNumber();                                \
+            R[ins.a] = makeValue;                                   \
+        } else {                                                    \
+            Value v = applyBinaryOp(opChar, LINE(), l, r);          \
+            if (isError(v)) {                                       \
+                return v;                                           \
+            }                                                       \
+            R[ins.a] = v;                                           \
+        }                                                           \
+        break;                                                      \
+    }
+
+    while (true) {
+        const Instruction ins = code[pc++];
+        switch (ins.op) {
+            case OP_LOADK:
+                R[ins.a] = chunk->constants[ins.c];
+                break;
+            case OP_MOVE:
+                R[ins.a] = R[ins.b];
+                break;
+            case OP_GETGLOBAL: {
+                const Value &v = globals[ins.c];
+                if (v.isNull()) {
+                    return makeError(LINE(), "Unrecognised variable!");
+                }
+                R[ins.a] = v;
+                break;
+            }
+            case OP_SETGLOBAL:
+                if (worker) {
+                    return makeError(LINE(), "Subs called from a Parallel For cannot assign globals!");
+                }
+                globals[ins.c] = R[ins.a];
+                break;
+            case OP_ADD: ARITH_OP('+', Value::number(x + y))
+            case OP_SUB: ARITH_OP('-', Value::number(x - y))
+            case OP_MUL: ARITH_OP('*', Value::number(x * y))
+            case OP_DIV: ARITH_OP('/', Value::number(x / y))
+            case OP_LT: ARITH_OP('<', Value::boolean(x < y))
+            case OP_GT: ARITH_OP('>', Value::boolean(x > y))
+            case OP_LE: ARITH_OP('L', Value::boolean(x <= y))
+            case OP_GE: ARITH_OP('G', Value::boolean(x >= y))
+            case OP_EQ: ARITH_OP('E', Value::boolean(x == y))
+            case OP_AND:
+            case OP_OR: {
+                Value v = applyBinaryOp(ins.op == OP_AND ? 'A' : 'O', LINE(), R[ins.b], R[ins.c]);
+                if (isError(v)) {
+                    return v;
+                }
+                R[ins.a] = v;
+                break;
+            }
+            case OP_NEG: {
+                Value v = applyUnaryOp(ins.c, LINE(), R[ins.b]);
+                if (isError(v)) {
+                    return v;
+                }
+                R[ins.a] = v;
+                break;
+            }
+            case OP_JMP:
+                pc = ins.c;
+                break;
+            case OP_JMPIFNOT:
+                if (!isTruthy(R[ins.a])) {
+                    pc = ins.c;
+                }
+                break;
+            case OP_PRINT: {
+                Value v = R[ins.a];
+                if (v.isNull()) {
+                    return makeError(LINE(), "Expected a value and received NULL!");
+                }
+                printValue(v);
+                break;
+            }
+            case OP_NEWLIST: {
+                ListValue *list = new ListValue();
+                list->reserve(ins.c);
+                R[ins.a] = Value::object(list);
+                break;
+            }
+            case OP_LISTPUSH:
+                R[ins.a].as<ListValue>()->addValue(R[ins.b]);
+                break;
+            case OP_NEWMAP:
+                R[ins.a] = Value::object(new MapValue());
+                break;
+            case OP_INDEX: {
+                ListValue *list = asList(R[ins.b]);
+                if (list != NULL && R[ins.c].isNumber() && list->inBounds(R[ins.c].asNumber())) {
+                    // Copied out first as R[A] may hold the list
+                    Value element = (*list)[(size_t)R[ins.c].asNumber()];
+                    R[ins.a] = element;
+                    break;
+                }
+                Value v = indexValue(LINE(), R[ins.b], R[ins.c]);
+                if (isError(v)) {
+                    return v;
+                }
+                R[ins.a] = v;
+                break;
+            }
+            case OP_SETINDEX: {
+                ListValue *list = asList(R[ins.a]);
+                if (list != NULL && R[ins.b].isNumber() && list->inBounds(R[ins.b].asNumber())) {
+                    list->setValue((size_t)R[ins.b].asNumber(), R[ins.c]);
+                    break;
+                }
+                Value v = assignIndex(LINE(), R[ins.a], R[ins.b], R[ins.c]);
+                if (isError(v)) {
+                    return v;
+                }
+                break;
+            }
+            case OP_BUILTIN: {
+                for (int i = 0; i < ins.b; i++) {
+                    if (R[ins.a + i].isNull()) {
+                        return makeError(LINE(), "Cannot have a statement as an arguement!");
+                    }
+                }
+                // Arguments are passed straight from the registers
+                Value v = program->builtins[ins.c]->execute(LINE(), ArgList(R + ins.a, ins.b));
+                if (isError(v)) {
+                    return v;
+                }
+                R[ins.a] = v;
+                break;
+            }
+            case OP_CALL: {
+                // The callee's frame starts at the first argument,
+                // the top level chunk does not count towards the depth
+                if (frames.size() > (size_t) interp->maxCallDepth) {
+                    return makeError(LINE(), "Maximum call depth exceeded!");
+                }
+                frames.back().pc = pc;
+                size_t base = frames.back().base + ins.a;
+                chunk = program->chunks[ins.c];
+                frames.push_back({chunk, 0, base});
+                ensureRegisters(base + chunk->numRegisters);
+                code = chunk->code.data();
+                R = registers.data() + base;
+                pc = 0;
+                for (int i = ins.b; i < chunk->numRegisters; i++) {
+                    R[i] = Value::null();
+                }
+                if (interp->runProfile) {
+                    interp->profiler.enterSub(chunk->name);
+                }
+                if (interp->debugger.hooks) {
+                    interp->debugger.enterSub();
+                }
+                break;
+            }
+            case OP_TAILCALL: {
+                // The arguments are above the locals so moving them
+                // down in order never overwrites one still to move
+                for (int i = 0; i < ins.b; i++) {
+                    R[i] = R[ins.a + i];
+                }
+                CallFrame &frame = frames.back();
+                chunk = program->chunks[ins.c];
+                frame.chunk = chunk;
+                ensureRegisters(frame.base + chunk->numRegisters);
+                code = chunk->code.data();
+                R = registers.data() + frame.base;
+                pc = 0;
+                for (int i = ins.b; i < chunk->numRegisters; i++) {
+                    R[i] = Value::null();
+                }
+                if (interp->runProfile) {
+                    interp->profiler.exitSub();
+                    interp->profiler.enterSub(chunk->name);
+                }
+                break;
+            }
+            case OP_GETLOCAL: {
+                const Value &v = R[ins.b];
+                if (v.isNull()) {
+                    return makeError(LINE(), "Unrecognised variable!");
+                }
+                R[ins.a] = v;
+                break;
+            }
+            case OP_FORINIT:
+            case OP_FORINITLOCAL: {
+                Value v = R[ins.a];
+                if (!v.isNumber()) {
+                    return makeError(LINE(), "For initialiser must be a number!");
+                }
+                if (worker && ins.op == OP_FORINIT) {
+                    return makeError(LINE(), "Subs called from a Parallel For cannot assign globals!");
+                }
+                (ins.op == OP_FORINIT ? globals[ins.b] : R[ins.b]) = v;
+                break;
+            }
+            case OP_FORPREP: {
+                Value max = R[ins.a + 1];
+                if (!max.isNumber()) {
+                    return makeError(LINE(), "For maximum must be a number!");
+                }
+                Value step = R[ins.a + 2];
+                if (!step.isNumber()) {
+                    return makeError(LINE(), "For step must be a number!");
+                }
+                R[ins.a + 3] = Value::number(0);
+                if (!forContinues(R[ins.a].asNumber(), max.asNumber(), step.asNumber())) {
+                    pc = ins.c;
+                }
+                break;
+            }
+            case OP_FORLOOP:
+            case OP_FORLOOPLOCAL: {
+                double i = R[ins.a + 3].asNumber() + 1;
+                R[ins.a + 3] = Value::number(i);
+                double next = forCounter(R[ins.a].asNumber(), R[ins.a + 2].asNumber(), i);
+                (ins.op == OP_FORLOOP ? globals[ins.b] : R[ins.b]) = Value::number(next);
+                if (forContinues(next, R[ins.a + 1].asNumber(), R[ins.a + 2].asNumber())) {
+                    pc = ins.c;
+                }
+                break;
+            }
+            case OP_PARFOR: {
+                Value v = runParallelFor(interp, program, program->loops[ins.c], R + ins.a, LINE());
+                if (isError(v)) {
+                    return v;
+                }
+                break;
+            }
+            case OP_DEBUG:
+                interp->debugger.statement(ins.c);
+                break;
+            case OP_LINE:
+                interp->profiler.line(ins.c);
+                break;
+            case OP_RETURN: {
+                // The result lands in the caller's register the
+                // frame started at, which the call targeted
+                Value result = ins.b ? R[ins.a] : Value::null();
+                size_t base = frames.back().base;
+                frames.pop_back();
+                if (frames.empty()) {
+                    return Value::null();
+                }
+                if (interp->runProfile) {
+                    interp->profiler.exitSub();
+                }
+                if (interp->debugger.hooks) {
+                    interp->debugger.exitSub();
+                }
+                CallFrame &frame = frames.back();
+                chunk = frame.chunk;
+                code = chunk->code.data();
+                R = registers.data() + frame.base;
+                pc = frame.pc;
+                registers[base] = result;
+                break;
+            }
+        }
+    }
+
+#undef ARITH_OP
+#undef LINE
+}
+
+/// Run a Parallel For whose bounds are in R[0] to R[2]. Workers
+/// claim blocks of iterations in order from a shared counter and
+/// run each on a VM of their own, keeping their own totals of the
+/// sums. Iterations after one that failed are skipped and the
+/// earliest failure is returned, the same error as running them
+/// in order gives.
+static Value runParallelFor(Interpreter *interp, Bytecode *program, const ParallelLoop &loop, const Value *R, int lineNum) {
+    size_t count;
+    Value error = interp->prepareParallelFor(lineNum, R[0], R[1], R[2], loop.sums, count);
+    if (!error.isNull() || count == 0) {
+        return error;
+    }
+    double start = R[0].asNumber();
+    double step = R[2].asNumber();
+    // The debugger and profiler are single threaded, with
+    // either on the iterations run in order on this thread
+    size_t workers = interp->debugger.hooks || interp->runProfile ? 1 : threadCount(interp->numThreads);
+    size_t block = std::max<size_t>(1, count / (workers * 8));
+    workers = std::min(workers, (count + block - 1) / block);
+    interp->shareGlobals(true);
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> failed(SIZE_MAX); // Earliest iteration to fail
+    std::mutex failureLock;
+    std::vector<std::vector<double>> totals(workers, std::vector<double>(loop.sums.size(), 0));
+    GCStats workerStats; // Heap counts of the pool threads, added to this thread's
+    long peakBefore = gcStats.peakLive;
+    gcStats.peakLive = gcStats.live;
+    runOnThreads(workers, [&](int w) {
+        threadsActive = workers > 1;
+        if (w > 0) {
+            gcStats = GCStats();
+        }
+        {
+            VM vm(interp, program, true);
+            std::vector<Value> args(1 + loop.sums.size(), Value::number(0));
+            while (true) {
+                size_t first = next.fetch_add(block);
+                if (first >= count || first > failed.load()) {
+                    break;
+                }
+                size_t last = std::min(count, first + block);
+                for (size_t i = first; i < last && i < failed.load(); i++) {
+                    args[0] = Value::number(forCounter(start, step, i));
+                    Value v = vm.call(loop.chunk, args.data(), args.size());
+                    if (!isError(v)) {
+                        v = addIterationSums(lineNum, vm.frame(), totals[w]);
+                    }
+                    if (isError(v)) {
+                        std::lock_guard<std::mutex> lock(failureLock);
+                        if (i < failed.load()) {
+                            failed = i;
+                            error = v;
+                        }
+                        break;
+                    }
+                }
+            }
+        }
+        if (w > 0) {
+            std::lock_guard<std::mutex> lock(failureLock);
+            workerStats.allocated += gcStats.allocated;
+            workerStats.freed += gcStats.freed;
+            workerStats.live += gcStats.live;
+            workerStats.peakLive += gcStats.peakLive;
+        }
+        threadsActive = false;
+    });
+    // The workers' peaks need not have coincided, so their
+    // sum gives an upper bound on the loop's peak
+    gcStats.allocated += workerStats.allocated;
+    gcStats.freed += workerStats.freed;
+    gcStats.live += workerStats.live;
+    gcStats.peakLive = std::max(peakBefore, gcStats.peakLive + workerStats.peakLive);
+    interp->shareGlobals(false);
+    if (!error.isNull()) {
+        return error;
+    }
+
+    std::vector<double> sums(loop.sums.size(), 0);
+    for (size_t w = 0; w < workers; w++) {
+        for (size_t i = 0; i < sums.size(); i++) {
+            sums[i] += totals[w][i];
+        }
+    }
+    interp->finishParallelFor(loop.sums, sums);
+    return Value::null();
+}
+
+/// Compile the interpreter's program and run it on a fresh VM.
+Value runBytecode(Interpreter *interp) {
+    Bytecode bytecode;
+    Value error = compile(interp->root, &bytecode, interp->debugger.hooks, interp->runProfile);
+    if (!error.isNull()) {
+        return error;
+    }
+    VM vm(interp, &bytecode);
+    return vm.run();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "node.hpp"
+#include "value.hpp"
+#include "bytecode.hpp"
+
+class Interpreter;
+
+/// Register based virtual machine executing compiled bytecode.
+/// Every Sub call pushes a frame on a single register stack,
+/// starting at the caller's register holding the first argument.
+/// Frames live on the heap, a tail call reuses the running one.
+/// A worker VM runs Parallel For iterations on one thread.
+class VM {
+public:
+    VM(Interpreter *interp, Bytecode *program, bool worker = false);
+    Value run();
+    Value call(uint32_t index, const Value *args, int argc);
+
+    /// Registers of the bottom frame, still readable after call returns.
+    const Value *frame() const {
+        return registers.data();
+    }
+
+private:
+    struct CallFrame {
+        Chunk *chunk;
+        size_t pc;
+        size_t base;
+    };
+
+    Interpreter *interp; // Globals, options and hooks of the running program
+    Bytecode *program;
+    bool worker; // Globals are shared with other threads so must not be assigned
+    std::vector<Value> registers;
+    std::vector<CallFrame> frames;
+
+    void ensureRegisters(size_t count);
+};
+
+Value runBytecode(Interpreter *interp);